@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <new>
+
+#include "CAllocCounter.h"
+
+#ifdef CALC_COUNT_ALLOCATIONS
+
+static thread_local uint64_t allocations = 0;
+
+void* operator new(size_t size)
+{
+    allocations++;
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    allocations++;
+    return malloc(size ? size : 1);
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    free(p);
+}
+
+uint64_t CAllocCounter::Get()
+{
+    return allocations;
+}
+
+bool CAllocCounter::Enabled()
+{
+    return true;
+}
+
+#else //CALC_COUNT_ALLOCATIONS
+
+uint64_t CAllocCounter::Get()
+{
+    return 0;
+}
+
+bool CAllocCounter::Enabled()
+{
+    return false;
+}
+
+#endif //CALC_COUNT_ALLOCATIONS
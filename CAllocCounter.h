@@ -0,0 +1,12 @@
+#pragma once
+#include <stdint.h>
+
+//Counts heap allocations made by the calling thread.
+//The global operator new is replaced only when CALC_COUNT_ALLOCATIONS is defined,
+//otherwise Get() always returns 0.
+class CAllocCounter
+{
+public:
+	static uint64_t Get();
+	static bool Enabled();
+};
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif //_WIN32
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "CBatchProcessor.h"
+#include "CLineReader.h"
+#include "CStageProfiler.h"
+#include "CThreadPool.h"
+#include "TBlockingQueue.hpp"
+#include "CLogger.h"
+
+//blocks read ahead per worker thread
+#define BATCH_BLOCKS_PER_THREAD 4
+
+struct SBatchBlock {
+    string storage;
+    string_view text;
+    string out;
+    bool done = false;
+};
+
+struct SBatchPipeline {
+    TBlockingQueue<unique_ptr<SBatchBlock>> input;  //blocks read, in input order
+    TBlockingQueue<unique_ptr<SBatchBlock>> output; //blocks being evaluated, in input order
+    //done of the blocks in output
+    mutex m;
+    condition_variable cv;
+    //written blocks, the reader takes them again with their buffers
+    mutex spare_m;
+    vector<unique_ptr<SBatchBlock>> spare;
+
+    explicit SBatchPipeline(size_t window) : input(window), output(window) {}
+    unique_ptr<SBatchBlock> Take()
+    {
+        lock_guard lock(spare_m);
+        if (spare.empty()) {
+            return unique_ptr<SBatchBlock>(new SBatchBlock);
+        }
+        unique_ptr<SBatchBlock> b = move(spare.back());
+        spare.pop_back();
+        return b;
+    }
+    void Recycle(unique_ptr<SBatchBlock> b)
+    {
+        b->out.clear();
+        b->done = false;
+        lock_guard lock(spare_m);
+        spare.push_back(move(b));
+    }
+};
+
+CBatchProcessor::CBatchProcessor(const SBatchOptions& options) :
+    m_threads(options.threads), m_cache(options.cache), m_output(options.dump ? OUTPUT_FORMAT::Text : options.output)
+{
+    if (m_threads == 0) {
+        m_threads = thread::hardware_concurrency();
+    }
+    if (m_threads == 0) {
+        m_threads = 1;
+    }
+    for (unsigned int i = 0; i < m_threads; i++) {
+        m_engines.emplace_back(new CCalculator);
+        m_engines.back()->SetCache(m_cache);
+        m_engines.back()->SetOptimization(options.optimization);
+        m_engines.back()->SetDump(options.dump);
+        m_engines.back()->SetBackend(options.backend);
+        m_engines.back()->SetOutput(m_output);
+    }
+}
+
+int CBatchProcessor::Run(const string& source)
+{
+    //no banners, no colors and no per-line flushes:
+    //results are collected in buffers and written out in large pieces
+    CLineReader reader;
+    if (!reader.Open(source)) {
+        cerr << "Can't open input file: " << source << endl;
+        return -1;
+    }
+    if (m_output == OUTPUT_FORMAT::Binary) {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif //_WIN32
+        fwrite(RESULT_BIN_MAGIC, 1, sizeof(RESULT_BIN_MAGIC) - 1, stdout);
+    }
+
+    //read, evaluate and write run at the same time: the reader thread fills the input
+    //queue, the calling thread evaluates the blocks or hands them to the pool, the writer
+    //thread writes them out in input order. A full queue holds the stage before it back.
+    const size_t window = (size_t)m_threads * BATCH_BLOCKS_PER_THREAD;
+    SBatchPipeline p(window);
+    thread readerThread([&reader, &p]() {
+        while (1) {
+            unique_ptr<SBatchBlock> b = p.Take();
+            if (!reader.Next(b->storage, b->text) || !p.input.Push(move(b))) {
+                break;
+            }
+        }
+        p.input.Close();
+    });
+    thread writerThread([&p]() {
+        unique_ptr<SBatchBlock> b;
+        while (p.output.Pop(b)) {
+            {
+                unique_lock lock(p.m);
+                p.cv.wait(lock, [&b] { return b->done; });
+            }
+            fwrite(b->out.data(), 1, b->out.size(), stdout);
+            p.Recycle(move(b));
+        }
+    });
+    int res = m_threads > 1 ? RunParallel(p) : RunSerial(p);
+    p.output.Close();
+    readerThread.join();
+    writerThread.join();
+    fflush(stdout);
+    PrintCacheStats();
+    if (CStageProfiler::Enabled()) {
+        PrintPipelineStats(p);
+    }
+    return res;
+}
+
+int CBatchProcessor::RunSerial(SBatchPipeline& p)
+{
+    CCalculator& calc = *m_engines[0];
+    unique_ptr<SBatchBlock> b;
+    while (p.input.Pop(b)) {
+        calc.EvaluateLines(b->text, b->out);
+        b->done = true;
+        p.output.Push(move(b));
+    }
+    return 0;
+}
+
+int CBatchProcessor::RunParallel(SBatchPipeline& p)
+{
+    //blocks are evaluated by the pool in any order,
+    //they enter the output queue in input order
+    CThreadPool pool(m_threads);
+    unique_ptr<SBatchBlock> b;
+    while (p.input.Pop(b)) {
+        SBatchBlock* block = b.get();
+        pool.Submit([this, block, &p]() {
+            CCalculator& calc = *m_engines[CThreadPool::WorkerIndex()];
+            calc.EvaluateLines(block->text, block->out);
+            {
+                lock_guard lock(p.m);
+                block->done = true;
+            }
+            p.cv.notify_all();
+        });
+        p.output.Push(move(b));
+    }
+    pool.Wait();
+    return 0;
+}
+
+void CBatchProcessor::PrintPipelineStats(SBatchPipeline& p)
+{
+    auto print = [](const char* name, const char* producer, const char* consumer, const SQueueStats& st, size_t capacity) {
+        char line[256];
+        snprintf(line, sizeof(line), "pipeline %s: blocks=%llu depth mean=%.1f max=%zu/%zu, %s waited %llu times, %s waited %llu times\n",
+            name, (unsigned long long)st.pushes, st.pushes ? (double)st.depth_sum / st.pushes : 0.0, st.max_depth, capacity,
+            producer, (unsigned long long)st.full_waits, consumer, (unsigned long long)st.empty_waits);
+        cerr << line;
+    };
+    print("read->evaluate", "read", "evaluate", p.input.Stats(), p.input.Capacity());
+    print("evaluate->write", "evaluate", "write", p.output.Stats(), p.output.Capacity());
+}
+
+void CBatchProcessor::PrintCacheStats()
+{
+    if (m_cache == 0) {
+        return;
+    }
+    CResultCache::SStats total;
+    size_t size = 0;
+    for (auto& e : m_engines) {
+        const CResultCache::SStats& st = e->Cache()->Stats();
+        total.hits += st.hits;
+        total.misses += st.misses;
+        total.evictions += st.evictions;
+        size += e->Cache()->Size();
+    }
+    cerr << "cache: hits=" << total.hits << " misses=" << total.misses << " evictions=" << total.evictions
+         << " size=" << size << "/" << m_cache * m_engines.size() << endl;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "CCalculator.h"
+
+using namespace std;
+
+struct SBatchOptions {
+	unsigned int threads = 0; //0 means one thread per hardware core
+	size_t cache = 0;         //LRU cache entries per thread, 0 disables the cache
+	unsigned int optimization = OPT_DEFAULT;
+	bool dump = false;        //write the optimized form instead of the result
+	BACKEND backend = BACKEND::Interpreter;
+	OUTPUT_FORMAT output = OUTPUT_FORMAT::Text;
+};
+
+//Non-interactive evaluation of newline-delimited expressions:
+//one result or "error: <message>" line is written per input line, in input order,
+//or the binary results described in CCalculator.h.
+class CBatchProcessor
+{
+public:
+	CBatchProcessor() = delete;
+	explicit CBatchProcessor(const SBatchOptions& options);
+	~CBatchProcessor() {}
+	int Run(const string& source);
+private:
+	unsigned int m_threads;
+	size_t m_cache;
+	OUTPUT_FORMAT m_output;
+	//one engine per thread, an engine keeps infix/postfix state of the expression in work
+	vector<unique_ptr<CCalculator>> m_engines;
+
+	int RunSerial(struct SBatchPipeline& p);
+	int RunParallel(struct SBatchPipeline& p);
+	void PrintCacheStats();
+	//queue depths between the stages, with --stats
+	void PrintPipelineStats(struct SBatchPipeline& p);
+};
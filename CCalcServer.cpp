@@ -0,0 +1,388 @@
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif //_WIN32
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include "CCalcServer.h"
+#include "CLogger.h"
+
+#define SERVER_MAX_EVENTS 64
+
+CCalcServer::CCalcServer(const SServerOptions& options, const SBatchOptions& engine) :
+    m_options(options), m_binary(engine.output == OUTPUT_FORMAT::Binary && !engine.dump)
+{
+    m_calc.SetCache(engine.cache);
+    m_calc.SetOptimization(engine.optimization);
+    m_calc.SetDump(engine.dump);
+    m_calc.SetBackend(engine.backend);
+    m_calc.SetOutput(m_binary ? OUTPUT_FORMAT::Binary : OUTPUT_FORMAT::Text);
+}
+
+#ifdef _WIN32
+
+CCalcServer::~CCalcServer() {}
+
+int CCalcServer::Run()
+{
+    cerr << "--serve needs epoll, it is not available on this platform" << endl;
+    return -1;
+}
+
+void CCalcServer::BlockSignals() {}
+
+#else //_WIN32
+
+CCalcServer::~CCalcServer()
+{
+    for (auto& c : m_clients) {
+        close(c.first);
+    }
+    for (int fd : m_listeners) {
+        close(fd);
+    }
+    if (m_options.socket.size()) {
+        unlink(m_options.socket.c_str());
+    }
+    if (m_signal >= 0) {
+        close(m_signal);
+    }
+    if (m_epoll >= 0) {
+        close(m_epoll);
+    }
+}
+
+bool CCalcServer::Listen()
+{
+    if (m_options.socket.size()) {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (m_options.socket.size() >= sizeof(addr.sun_path)) {
+            cerr << "socket path is too long: " << m_options.socket << endl;
+            return false;
+        }
+        strcpy(addr.sun_path, m_options.socket.c_str());
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        //a socket file left by a previous run
+        unlink(addr.sun_path);
+        if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+            cerr << "can't listen on " << m_options.socket << ": " << strerror(errno) << endl;
+            if (fd >= 0) {
+                close(fd);
+            }
+            return false;
+        }
+        m_listeners.push_back(fd);
+    }
+    if (m_options.port) {
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)m_options.port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        if (fd >= 0) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        }
+        if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+            cerr << "can't listen on 127.0.0.1:" << m_options.port << ": " << strerror(errno) << endl;
+            if (fd >= 0) {
+                close(fd);
+            }
+            return false;
+        }
+        m_listeners.push_back(fd);
+    }
+    if (m_listeners.empty()) {
+        cerr << "nothing to listen on, give a socket path or a port" << endl;
+        return false;
+    }
+    for (int fd : m_listeners) {
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev);
+    }
+    return true;
+}
+
+static void ServerSignals(sigset_t& mask)
+{
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+}
+
+void CCalcServer::BlockSignals()
+{
+    //a signal not blocked in every thread may go to one that does not read the signalfd
+    //and kill the process before the drain, new threads inherit the mask of their creator
+    sigset_t mask;
+    ServerSignals(mask);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+}
+
+int CCalcServer::Run()
+{
+    //SIGTERM and SIGINT are read from a signalfd by the loop, writes to a closed
+    //client must fail with EPIPE instead of killing the server;
+    //blocking here again is a no-op when main() has done it before starting threads
+    BlockSignals();
+    sigset_t mask;
+    ServerSignals(mask);
+    signal(SIGPIPE, SIG_IGN);
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    m_signal = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (m_epoll < 0 || m_signal < 0 || !Listen()) {
+        return -1;
+    }
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = m_signal;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_signal, &ev);
+    cerr << "serving";
+    if (m_options.socket.size()) {
+        cerr << " " << m_options.socket;
+    }
+    if (m_options.port) {
+        cerr << " 127.0.0.1:" << m_options.port;
+    }
+    cerr << endl;
+
+    typedef chrono::steady_clock clock;
+    clock::time_point deadline;
+    epoll_event events[SERVER_MAX_EVENTS];
+    while (!m_draining || m_clients.size()) {
+        int timeout = -1;
+        if (m_draining) {
+            auto left = chrono::duration_cast<chrono::milliseconds>(deadline - clock::now()).count();
+            if (left <= 0) {
+                cerr << "drain timeout, " << m_clients.size() << " clients dropped" << endl;
+                break;
+            }
+            timeout = (int)left;
+        }
+        int n = epoll_wait(m_epoll, events, SERVER_MAX_EVENTS, timeout);
+        if (n < 0 && errno != EINTR) {
+            cerr << "epoll_wait: " << strerror(errno) << endl;
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == m_signal) {
+                signalfd_siginfo si;
+                while (read(m_signal, &si, sizeof(si)) == sizeof(si)) {
+                }
+                if (!m_draining) {
+                    StartDrain();
+                    deadline = clock::now() + chrono::milliseconds(m_options.drain_ms);
+                }
+                continue;
+            }
+            if (find(m_listeners.begin(), m_listeners.end(), fd) != m_listeners.end()) {
+                Accept(fd);
+                continue;
+            }
+            auto it = m_clients.find(fd);
+            if (it == m_clients.end()) {
+                continue;
+            }
+            SClient& c = *it->second;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                OnRead(c);
+            }
+            if (Flush(c)) {
+                Update(c);
+            }
+        }
+    }
+    cerr << "served " << m_requests << " requests from " << m_accepted << " clients" << endl;
+    return 0;
+}
+
+void CCalcServer::Accept(int listener)
+{
+    while (1) {
+        int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                LOGE("accept: %s\n", strerror(errno));
+            }
+            return;
+        }
+        int one = 1;
+        //fails harmlessly on a Unix domain socket
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        unique_ptr<SClient> c(new SClient);
+        c->fd = fd;
+        if (m_binary) {
+            c->out.assign(RESULT_BIN_MAGIC, sizeof(RESULT_BIN_MAGIC) - 1);
+        }
+        epoll_event ev = {};
+        ev.events = c->events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev);
+        m_clients[fd] = move(c);
+        m_accepted++;
+        LOGD("client %d connected\n", fd);
+    }
+}
+
+void CCalcServer::OnRead(SClient& c)
+{
+    if (c.closing) {
+        return;
+    }
+    //a few reads per wakeup, so one busy client can't starve the others
+    for (int reads = 0; reads < 4 && c.out.size() - c.sent < m_options.max_output; reads++) {
+        size_t old = c.in.size();
+        c.in.resize(old + SERVER_READ_SIZE);
+        ssize_t n = read(c.fd, &c.in[old], SERVER_READ_SIZE);
+        c.in.resize(old + (n > 0 ? n : 0));
+        if (n == 0) {
+            //the client is done sending, the last line may lack its '\n'
+            Evaluate(c, c.in.size());
+            c.closing = true;
+            return;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                c.closing = true;
+                c.out.clear();
+                c.sent = 0;
+            }
+            return;
+        }
+        size_t end = c.in.rfind('\n');
+        if (end != string::npos) {
+            Evaluate(c, end + 1);
+        }
+        if (c.in.size() > m_options.max_line) {
+            c.out += "error: request line too long\n";
+            c.in.clear();
+            c.closing = true;
+            return;
+        }
+        if ((size_t)n < SERVER_READ_SIZE) {
+            return;
+        }
+    }
+}
+
+void CCalcServer::Evaluate(SClient& c, size_t len)
+{
+    if (!len) {
+        return;
+    }
+    string_view text(c.in.data(), len);
+    m_requests += count(text.begin(), text.end(), '\n') + (text.back() != '\n' ? 1 : 0);
+    m_calc.EvaluateLines(text, c.out);
+    c.in.erase(0, len);
+}
+
+bool CCalcServer::Flush(SClient& c)
+{
+    while (c.sent < c.out.size()) {
+        ssize_t n = send(c.fd, c.out.data() + c.sent, c.out.size() - c.sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            //the client went away, its results are dropped
+            Close(c);
+            return false;
+        }
+        c.sent += n;
+    }
+    if (c.sent == c.out.size()) {
+        c.out.clear();
+        c.sent = 0;
+    }
+    else if (c.sent > SERVER_READ_SIZE && c.sent * 2 > c.out.size()) {
+        c.out.erase(0, c.sent);
+        c.sent = 0;
+    }
+    if (c.closing && c.out.empty()) {
+        Close(c);
+        return false;
+    }
+    return true;
+}
+
+void CCalcServer::Update(SClient& c)
+{
+    size_t pending = c.out.size() - c.sent;
+    uint32_t events = 0;
+    //backpressure: stop reading while the client doesn't take its results,
+    //resume once half of them are written
+    bool paused = pending >= m_options.max_output ||
+        ((c.events & EPOLLIN) == 0 && pending > m_options.max_output / 2);
+    if (!c.closing && !paused) {
+        events |= EPOLLIN;
+    }
+    if (pending) {
+        events |= EPOLLOUT;
+    }
+    if (events != c.events) {
+        epoll_event ev = {};
+        ev.events = events;
+        ev.data.fd = c.fd;
+        epoll_ctl(m_epoll, EPOLL_CTL_MOD, c.fd, &ev);
+        c.events = events;
+    }
+}
+
+void CCalcServer::Close(SClient& c)
+{
+    int fd = c.fd;
+    LOGD("client %d closed\n", fd);
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    m_clients.erase(fd);
+}
+
+void CCalcServer::StartDrain()
+{
+    //no new clients and no new requests, the results of the read ones are written out
+    cerr << "draining " << m_clients.size() << " clients" << endl;
+    m_draining = true;
+    for (int fd : m_listeners) {
+        epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+    }
+    m_listeners.clear();
+    vector<SClient*> clients;
+    for (auto& c : m_clients) {
+        clients.push_back(c.second.get());
+    }
+    for (SClient* c : clients) {
+        //complete lines were evaluated when they were read
+        c->in.clear();
+        c->closing = true;
+        if (Flush(*c)) {
+            Update(*c);
+        }
+    }
+}
+
+#endif //_WIN32
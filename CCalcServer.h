@@ -0,0 +1,71 @@
+#pragma once
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "CBatchProcessor.h"
+
+using namespace std;
+
+//pending result bytes of a client before the server stops reading its requests
+#define SERVER_MAX_OUTPUT (1024 * 1024)
+//longest request line
+#define SERVER_MAX_LINE (64 * 1024)
+#define SERVER_READ_SIZE (64 * 1024)
+
+struct SServerOptions {
+	string socket;            //Unix domain socket path, empty for none
+	unsigned int port = 0;    //127.0.0.1 TCP port, 0 for none
+	size_t max_output = SERVER_MAX_OUTPUT;
+	size_t max_line = SERVER_MAX_LINE;
+	unsigned int drain_ms = 5000; //longest wait for the clients after SIGTERM
+};
+
+//Expression server: newline-delimited requests, one result or "error: <message>" line
+//per request, in request order, exactly like --batch. Clients may pipeline any number
+//of requests. One epoll loop serves every client with a single engine; a client whose
+//results pile up is not read until it takes them. SIGTERM or SIGINT stop accepting,
+//results of the requests already read are written out, then the server exits.
+class CCalcServer
+{
+public:
+	CCalcServer() = delete;
+	CCalcServer(const SServerOptions& options, const SBatchOptions& engine);
+	~CCalcServer();
+	//serves until SIGTERM/SIGINT, returns 0 or -1 if the sockets can't be set up
+	int Run();
+	//blocks SIGTERM and SIGINT for the calling thread and the threads it starts later,
+	//Run() reads them from a signalfd; call it before any other thread is started
+	static void BlockSignals();
+private:
+	struct SClient {
+		int fd;
+		string in;
+		string out;
+		size_t sent = 0;       //bytes of out already written
+		uint32_t events = 0;   //epoll interest
+		bool closing = false;  //no more requests, close when out is written
+	};
+	SServerOptions m_options;
+	CCalculator m_calc;
+	bool m_binary;
+	int m_epoll = -1;
+	int m_signal = -1;
+	vector<int> m_listeners;
+	unordered_map<int, unique_ptr<SClient>> m_clients;
+	bool m_draining = false;
+	uint64_t m_requests = 0;
+	uint64_t m_accepted = 0;
+
+	bool Listen();
+	void Accept(int listener);
+	void OnRead(SClient& c);
+	void Evaluate(SClient& c, size_t len);
+	//writes what the socket takes, returns false when the client is gone
+	bool Flush(SClient& c);
+	void Update(SClient& c);
+	void Close(SClient& c);
+	void StartDrain();
+};
@@ -0,0 +1,264 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <algorithm>
+#include <iostream>
+
+#include "CCalcSession.h"
+#include "CLineReader.h"
+#include "CLogger.h"
+
+#define SESSION_OUT_BUF_SIZE (64 * 1024)
+
+static bool IsName(string_view name)
+{
+    if (name.empty() || !(isalpha((unsigned char)name[0]) || name[0] == '_')) {
+        return false;
+    }
+    for (char ch : name) {
+        if (!(isalnum((unsigned char)ch) || ch == '_')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static string_view Trim(string_view s)
+{
+    size_t start = s.find_first_not_of(" \t");
+    if (start == string_view::npos) {
+        return string_view();
+    }
+    size_t end = s.find_last_not_of(" \t");
+    return s.substr(start, end - start + 1);
+}
+
+int CCalcSession::Find(string_view name) const
+{
+    //the map is keyed by string, a lookup by string_view would need C++20 heterogeneous lookup
+    auto it = m_index.find(string(name));
+    return it == m_index.end() ? -1 : (int)it->second;
+}
+
+uint32_t CCalcSession::Cell(string_view name)
+{
+    int idx = Find(name);
+    if (idx >= 0) {
+        return (uint32_t)idx;
+    }
+    m_cells.emplace_back();
+    m_cells.back().name = name;
+    m_index[m_cells.back().name] = (uint32_t)(m_cells.size() - 1);
+    return (uint32_t)(m_cells.size() - 1);
+}
+
+void CCalcSession::Downstream(uint32_t cell)
+{
+    if (++m_epoch == 0) {
+        for (auto& c : m_cells) {
+            c.mark = 0;
+        }
+        m_epoch = 1;
+    }
+    //depth first over the users, a cell is finished after all its users:
+    //the reversed finishing order is topological
+    m_order.clear();
+    m_stack.clear();
+    m_cells[cell].mark = m_epoch;
+    m_stack.push_back({ cell, 0 });
+    while (m_stack.size()) {
+        uint32_t idx = m_stack.back().first;
+        uint32_t next = m_stack.back().second;
+        const vector<uint32_t>& users = m_cells[idx].users;
+        if (next < users.size()) {
+            m_stack.back().second++;
+            uint32_t u = users[next];
+            if (m_cells[u].mark != m_epoch) {
+                m_cells[u].mark = m_epoch;
+                m_stack.push_back({ u, 0 });
+            }
+        }
+        else {
+            m_order.push_back(idx);
+            m_stack.pop_back();
+        }
+    }
+    reverse(m_order.begin(), m_order.end());
+}
+
+void CCalcSession::Recompute(SCell& c)
+{
+    if (!c.defined) {
+        c.error = CALC_ERR_VARIABLE;
+        return;
+    }
+    m_args.resize(c.deps.size());
+    for (size_t i = 0; i < c.deps.size(); i++) {
+        const SCell& d = m_cells[c.deps[i]];
+        if (d.error != CALC_OK) {
+            c.error = CALC_ERR_VARIABLE;
+            return;
+        }
+        m_args[i] = d.value;
+    }
+    c.value = c.prog.Evaluate(m_args.data());
+    c.error = CALC_OK;
+}
+
+int CCalcSession::Define(string_view name, string_view expr, vector<uint32_t>* changed)
+{
+    int res = m_calc.Compile(expr, m_prog);
+    if (res != CALC_OK) {
+        return res;
+    }
+    //a cycle is closed when the expression reads the cell itself or one of its users,
+    //a new cell has no users yet
+    int self = Find(name);
+    if (self >= 0) {
+        Downstream((uint32_t)self);
+    }
+    for (auto& v : m_prog.Variables()) {
+        int d = Find(v);
+        if (v == name || (self >= 0 && d >= 0 && m_cells[d].mark == m_epoch)) {
+            LOGE("%.*s: circular reference through %s\n", (int)name.size(), name.data(), v.c_str());
+            return CALC_ERR_CYCLE;
+        }
+    }
+    uint32_t cell = Cell(name);
+    for (uint32_t d : m_cells[cell].deps) {
+        vector<uint32_t>& users = m_cells[d].users;
+        users.erase(find(users.begin(), users.end(), cell));
+    }
+    m_cells[cell].deps.clear();
+    for (auto& v : m_prog.Variables()) {
+        //Cell() may grow m_cells, no references are held across it
+        uint32_t d = Cell(v);
+        m_cells[d].users.push_back(cell);
+        m_cells[cell].deps.push_back(d);
+    }
+    swap(m_cells[cell].prog, m_prog);
+    m_cells[cell].defined = true;
+    if (self < 0) {
+        Downstream(cell);
+    }
+    //the users of the cell did not change, m_order is still its downstream
+    for (uint32_t idx : m_order) {
+        Recompute(m_cells[idx]);
+    }
+    if (changed) {
+        changed->assign(m_order.begin(), m_order.end());
+    }
+    return CALC_OK;
+}
+
+int CCalcSession::Evaluate(string_view expr, double& result)
+{
+    int res = m_calc.Compile(expr, m_prog);
+    if (res != CALC_OK) {
+        return res;
+    }
+    m_args.resize(m_prog.Variables().size());
+    for (size_t i = 0; i < m_args.size(); i++) {
+        res = Get(m_prog.Variables()[i], m_args[i]);
+        if (res != CALC_OK) {
+            return res;
+        }
+    }
+    result = m_prog.Evaluate(m_args.data());
+    return CALC_OK;
+}
+
+int CCalcSession::Get(string_view name, double& value) const
+{
+    int idx = Find(name);
+    if (idx < 0) {
+        return CALC_ERR_VARIABLE;
+    }
+    const SCell& c = m_cells[idx];
+    if (c.error == CALC_OK) {
+        value = c.value;
+    }
+    return c.error;
+}
+
+void CCalcSession::EvaluateLine(string_view line, string& out)
+{
+    char num[64];
+    //accept CRLF input and the interactive trailing '='
+    if (line.size() && line.back() == '\r') {
+        line.remove_suffix(1);
+    }
+    if (line.size() && line.back() == '=') {
+        line.remove_suffix(1);
+    }
+    if (Trim(line).empty()) {
+        out += '\n';
+        return;
+    }
+    size_t eq = line.find('=');
+    if (eq == string_view::npos) {
+        double result = 0;
+        int res = Evaluate(line, result);
+        if (res == CALC_OK) {
+            out.append(num, FormatResult(num, sizeof(num), result));
+        }
+        else {
+            out += "error: ";
+            out += CalcErrorString(res);
+        }
+        out += '\n';
+        return;
+    }
+    string_view name = Trim(line.substr(0, eq));
+    vector<uint32_t> changed;
+    int res = IsName(name) ? Define(name, line.substr(eq + 1), &changed) : CALC_ERR_EXPRESSION;
+    if (res != CALC_OK) {
+        out += "error: ";
+        out += CalcErrorString(res);
+        out += '\n';
+        return;
+    }
+    for (uint32_t idx : changed) {
+        const SCell& c = m_cells[idx];
+        out += c.name;
+        out += " = ";
+        if (c.error == CALC_OK) {
+            out.append(num, FormatResult(num, sizeof(num), c.value));
+        }
+        else {
+            out += "error: ";
+            out += CalcErrorString(c.error);
+        }
+        out += '\n';
+    }
+}
+
+int CCalcSession::Run(const string& source)
+{
+    //cells depend on the lines before them, so the lines are evaluated one after another
+    CLineReader reader;
+    if (!reader.Open(source)) {
+        cerr << "Can't open input file: " << source << endl;
+        return -1;
+    }
+    string storage;
+    string_view text;
+    string out;
+    while (reader.Next(storage, text)) {
+        size_t pos = 0;
+        while (pos < text.size()) {
+            size_t end = text.find('\n', pos);
+            if (end == string_view::npos) {
+                end = text.size();
+            }
+            EvaluateLine(text.substr(pos, end - pos), out);
+            pos = end + 1;
+            if (out.size() >= SESSION_OUT_BUF_SIZE) {
+                fwrite(out.data(), 1, out.size(), stdout);
+                out.clear();
+            }
+        }
+    }
+    fwrite(out.data(), 1, out.size(), stdout);
+    fflush(stdout);
+    return 0;
+}
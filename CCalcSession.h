@@ -0,0 +1,64 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "CCalculator.h"
+
+using namespace std;
+
+//Named cells kept between expressions: "total = a + b" compiles the expression once
+//and keeps its value. Expressions read other cells by name. The cells form a dependency
+//graph, so a (re)definition re-evaluates only the cells downstream of it, in topological
+//order. A definition that would close a cycle is refused, the session stays as it was.
+class CCalcSession
+{
+public:
+	CCalcSession() {}
+	~CCalcSession() {}
+	//"-" is the standard input. Every "name = expression" line defines a cell and writes
+	//"name = value" for it and for every cell re-evaluated because of it, other lines are
+	//evaluated over the current cells and write their result like --batch.
+	int Run(const string& source);
+	//one line of Run()
+	void EvaluateLine(string_view line, string& out);
+	//defines or redefines a cell, changed (if any) receives the re-evaluated cells in evaluation order
+	int Define(string_view name, string_view expr, vector<uint32_t>* changed = nullptr);
+	//one-off expression over the current cell values
+	int Evaluate(string_view expr, double& result);
+	//value of a cell: CALC_ERR_VARIABLE if it is not defined or reads an undefined or failed cell
+	int Get(string_view name, double& value) const;
+	const string& Name(uint32_t cell) const { return m_cells[cell].name; }
+	size_t Size() const { return m_cells.size(); }
+	//parser and optimizer settings of the cell expressions
+	CCalculator& Engine() { return m_calc; }
+private:
+	struct SCell {
+		string name;
+		CCompiledExpression prog;
+		vector<uint32_t> deps;   //cell of prog.Variables()[i]
+		vector<uint32_t> users;  //cells that read this one
+		double value = 0;
+		int error = CALC_ERR_VARIABLE; //referenced before it was defined
+		bool defined = false;
+		uint32_t mark = 0;       //m_epoch of the last traversal that visited it
+	};
+	CCalculator m_calc;
+	vector<SCell> m_cells;
+	unordered_map<string, uint32_t> m_index;
+	uint32_t m_epoch = 0;
+	//scratch buffers, kept between calls
+	CCompiledExpression m_prog;
+	vector<uint32_t> m_order;
+	vector<pair<uint32_t, uint32_t>> m_stack;
+	vector<double> m_args;
+
+	int Find(string_view name) const;
+	//finds the cell or adds an undefined one
+	uint32_t Cell(string_view name);
+	//cell and every cell reading it directly or not, in topological order, marked with m_epoch
+	void Downstream(uint32_t cell);
+	void Recompute(SCell& c);
+};
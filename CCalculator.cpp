@@ -1,15 +1,19 @@
 ﻿#include <iostream>
 #include <iterator>
-#include <stack>
-#include <sstream>
+#include <charconv>
 #include <cmath>
+#include <stdio.h>
+#include <string.h>
 
 #include "CCalculator.h"
+#include "CAllocCounter.h"
+#include "CStageProfiler.h"
 #include "CLogger.h"
 
 #define IS_OPERATION(x) (x == '+' || x == '-' || x == '*' || x == '/' || x == '^')
 #define IS_DIGIT(x) (x >= '0' && x <= '9')
-#define IS_NUMBER(x) (IS_DIGIT(x) || x == '.' || x == ',')
+#define IS_ALPHA(x) ((x >= 'a' && x <= 'z') || (x >= 'A' && x <= 'Z') || x == '_')
+#define IS_NUMBER(x) (IS_DIGIT(x) || x == '.')
 #define IS_SPACE(x) (x  == ' ' || x  == '\t')
 
 vector<string> test_expr = {
@@ -27,76 +31,223 @@ vector<string> test_expr = {
     "\t\t\t22+33*44",
     "22+33*\t\t\t44",
     "22+33*44\t\t\t",
+    "sqrt(16) + max(1, 2, 3)",
+    "2 * sin(0.5) ^ 2 + cos(1)",
+    "min(3, abs(-2 - 5)) * exp(log(2))",
+    "sqrt(1, 2)",
+    "max()",
+    "foo(2)",
 };
 
-unsigned int CCalculator::GetToken(const string& expr, unsigned int start, CToken& token)
+struct SFunction {
+    const char* name;
+    int code; //CCalculator::TOKEN
+};
+
+const char* CalcErrorString(int err)
+{
+    switch (err) {
+    case CALC_OK:
+        return "OK.";
+    case CALC_ERR_EMPTY:
+        return "Empty expression.";
+    case CALC_ERR_OPERATION:
+        return "Wrong operation sign.";
+    case CALC_ERR_SYMBOL:
+        return "Unknown symbol.";
+    case CALC_ERR_PARENTHESIS:
+        return "Wrong number of parenthesis.";
+    case CALC_ERR_EXPRESSION:
+        return "Wrong expression.";
+    case CALC_ERR_VARIABLE:
+        return "Variable has no value.";
+    case CALC_ERR_CYCLE:
+        return "Circular reference.";
+    case CALC_ERR_FUNCTION:
+        return "Unknown function.";
+    case CALC_ERR_ARGUMENTS:
+        return "Wrong number of function arguments.";
+    case CALC_ERR_RANGE:
+        return "Too many points.";
+    default:
+        return "Unknown error.";
+    }
+}
+
+const char* CCalculator::TokenName(TOKEN code)
+{
+    static const char* names[] = { "number", "variable", "+", "-", "*", "/", "^", "(", ")", ",",
+        "sqrt", "abs", "exp", "log", "sin", "cos", "min", "max" };
+    return (size_t)code < sizeof(names) / sizeof(names[0]) ? names[(size_t)code] : "?";
+}
+
+int CCalculator::Precedence(TOKEN code)
 {
-    bool check_sign = false;
-    if (start == 0) {
-        check_sign = true;
+    switch (code) {
+    case TOKEN::Add:
+    case TOKEN::Sub:
+        return 1;
+    case TOKEN::Mul:
+    case TOKEN::Div:
+        return 2;
+    case TOKEN::Pow:
+        return 3;
+    default:
+        return 0;
     }
-    while (IS_SPACE(expr[start])) {
+}
+
+int CCalculator::GetToken(string_view expr, unsigned int start, bool sign, CToken& token) const
+{
+    //tokens are slices of expr, nothing is copied or allocated here
+    //a minus is a sign at the start and after '(' or ','
+    bool check_sign = start == 0 || sign;
+    const unsigned int len = (unsigned int)expr.size();
+    while (start < len && IS_SPACE(expr[start])) {
         start++;
     }
-    if (start == expr.size()) {
+    if (start == len) {
         return 0;
     }
     unsigned int i = start;
+    token.dval = 0;
     if (IS_DIGIT(expr[i])) {
         //number
-        while (IS_NUMBER(expr[i])) {
+        while (i < len && IS_NUMBER(expr[i])) {
             i++;
         }
         token.sval = expr.substr(start, i - start);
-        token.tok = TOKENS::Number;
-        istringstream(token.sval) >> token.dval;
+        token.code = TOKEN::Number;
+        from_chars(expr.data() + start, expr.data() + i, token.dval);
+    }
+    else if (IS_ALPHA(expr[i])) {
+        //variable name, or function name when '(' follows it
+        while (i < len && (IS_ALPHA(expr[i]) || IS_DIGIT(expr[i]))) {
+            i++;
+        }
+        token.sval = expr.substr(start, i - start);
+        token.code = TOKEN::Variable;
+        unsigned int j = i;
+        while (j < len && IS_SPACE(expr[j])) {
+            j++;
+        }
+        if (j < len && expr[j] == '(') {
+            static const SFunction functions[] = {
+                { "sqrt", (int)TOKEN::Sqrt },
+                { "abs", (int)TOKEN::Abs },
+                { "exp", (int)TOKEN::Exp },
+                { "log", (int)TOKEN::Log },
+                { "sin", (int)TOKEN::Sin },
+                { "cos", (int)TOKEN::Cos },
+                { "min", (int)TOKEN::Min },
+                { "max", (int)TOKEN::Max },
+            };
+            const SFunction* f = nullptr;
+            for (const SFunction& x : functions) {
+                if (token.sval == x.name) {
+                    f = &x;
+                    break;
+                }
+            }
+            if (!f) {
+                LOGE("Unknown function = %.*s\n", (int)token.sval.size(), token.sval.data());
+                return CALC_ERR_FUNCTION;
+            }
+            token.code = (TOKEN)f->code;
+        }
+    }
+    else if (expr[i] == ',') {
+        //function argument separator
+        token.code = TOKEN::Comma;
+        i++;
+        token.sval = expr.substr(start, 1);
     }
     else if (expr[i] == '(' || expr[i] == ')') {
         //expression
+        token.code = expr[i] == '(' ? TOKEN::LParen : TOKEN::RParen;
         i++;
-        token.sval = expr.substr(start, i - start);
-        token.dval = token.sval[0];
-        token.tok = TOKENS::Expr;
+        token.sval = expr.substr(start, 1);
     }
     else if (IS_OPERATION(expr[i])) {
         //operation
         token.sval = expr.substr(start, 1);
-        token.tok = TOKENS::Operator;
         i++;
         switch (token.sval[0]) {
         case '+':
-            token.dval = 1;//priority
+            token.code = TOKEN::Add;
             break;
         case '-':
-            token.dval = 1;
+            token.code = TOKEN::Sub;
             if (check_sign) {
-                i = GetToken(expr, i, token);
-                token.dval = -token.dval;
+                //it is a sign only when a number follows it
+                unsigned int j = i;
+                while (j < len && IS_SPACE(expr[j])) {
+                    j++;
+                }
+                if (j < len && IS_DIGIT(expr[j])) {
+                    i = GetToken(expr, i, false, token);
+                    token.dval = -token.dval;
+                }
             }
             break;
         case '*':
-            token.dval = 2;
+            token.code = TOKEN::Mul;
             break;
         case '/':
-            token.dval = 2;
+            token.code = TOKEN::Div;
             break;
         case '^':
-            token.dval = 3;
+            token.code = TOKEN::Pow;
             break;
         default:
-            LOGE("Wrong operation = %s\n", token.sval.c_str());
-            return -1;
+            LOGE("Wrong operation = %c\n", token.sval[0]);
+            return CALC_ERR_OPERATION;
         }
     }
-    if (token.tok == TOKENS::Number) {
+    else {
+        LOGE("Unknown symbol = %c\n", expr[i]);
+        return CALC_ERR_SYMBOL;
+    }
+    if (token.code == TOKEN::Number) {
         LOGD("len=%d token = %f\n", i, token.dval);
     }
     else {
-        LOGD("len=%d token = %s\n", i, token.sval.c_str());
+        LOGD("len=%d token = %.*s\n", i, (int)token.sval.size(), token.sval.data());
     }
     return i;
 }
 
+void CCalculator::AppendToken(const CToken& token)
+{
+    infix.push_back(token.code);
+    if (token.code == TOKEN::Number) {
+        numbers.push_back(token.dval);
+    }
+    else if (token.code == TOKEN::Variable) {
+        names.push_back(token.sval);
+    }
+}
+
+unsigned int CCalculator::TokenOffset(string_view expr, size_t idx) const
+{
+    //only called for error messages: the expression is tokenized again up to token idx,
+    //the token streams are left alone
+    CToken token;
+    unsigned int start = 0;
+    bool sign = false;
+    for (size_t n = 0;; n++) {
+        while (start < expr.size() && IS_SPACE(expr[start])) {
+            start++;
+        }
+        int next = n < idx ? GetToken(expr, start, sign, token) : 0;
+        if (next <= 0) {
+            return start;
+        }
+        sign = token.code == TOKEN::LParen || token.code == TOKEN::Comma;
+        start = next;
+    }
+}
+
 //Operator	Precedence	Associativity
 //   ^         4        Right
 //   ×         3        Left
@@ -112,65 +263,98 @@ void CCalculator::InfixToPostfix()
     //https://en.wikipedia.org/wiki/Shunting-yard_algorithm
     //a mistake with ^ operator associativity was fixed
     //
-    //This implementation does not implement composite functions,
-    //unctions with variable number of arguments, and unary operators.
-    stack<CToken> oper;
-    for (auto x : infix) {
+    //This implementation does not implement unary operators.
+    //ParseStringToInfix() has checked the number of function arguments.
+    //Numbers and variables are not moved, only their order matters and it does not change.
+    vector<TOKEN>& oper = opstack;
+    oper.clear();
+    postfix.clear();
+    //operands pushed so far, they index numbers and names for the debug log
+    size_t nums = 0;
+    size_t vars = 0;
+    for (TOKEN x : infix) {
         //while there are tokens to be read do:
         //read a token.
-        if (x.tok == TOKENS::Number) {
+        if (x == TOKEN::Number) {
             //if the token is a number, then :
             //push it to the output queue.
-            postfix.push(x);
-            LOGD("push: %f\n", x.dval);
+            postfix.push_back(x);
+            LOGD("push: %f\n", numbers[nums]);
+            nums++;
+        }
+        else if (x == TOKEN::Variable) {
+            postfix.push_back(x);
+            LOGD("push: %.*s\n", (int)names[vars].size(), names[vars].data());
+            vars++;
         }
-        else if (x.tok == TOKENS::Function) {
+        else if (x >= TOKEN::Sqrt) {
             //if the token is a function then :
             //push it onto the operator stack
+            oper.push_back(x);
         }
-        else if (x.tok == TOKENS::Operator) {
+        else if (x == TOKEN::Comma) {
+            //if the token is a function argument separator, then :
+            //pop the operators above the function's left paren onto the output queue.
+            while (oper.back() != TOKEN::LParen) {
+                postfix.push_back(oper.back());
+                LOGD("push: %s\n", TokenName(oper.back()));
+                oper.pop_back();
+            }
+            //min and max work like a binary operator between their arguments:
+            //min(a, b, c) is a b min c min
+            oper.push_back(oper[oper.size() - 2]);
+        }
+        else if (x >= TOKEN::Add && x <= TOKEN::Pow) {
             //if the token is an operator, then :
             //while (
             while (oper.size()
-                //    (there is a function at the top of the operator stack)
-                && (oper.top().tok == TOKENS::Function
-                    // or (there is an operator at the top of the operator stack with greater precedence)
-                    || (oper.top().tok == TOKENS::Operator
-                        && oper.top().dval >= x.dval)
-                    //                // or (the operator at the top of the operator stack has equal precedence and is left associative)) - ???
-                    //                || (   oper.top().tok  == TOKENS::Operator
-                    //                    && oper.top().dval == x.dval
-                    //                    && oper.top().sval[0] != '^')//'^' is right associative
-                                    // and (the operator at the top of the operator stack is not a left parenthesis) :
-                    ))
+                // (there is an operator at the top of the operator stack with greater precedence)
+                //  a function is always below its left paren, so it is never at the top here
+                && oper.back() >= TOKEN::Add && oper.back() <= TOKEN::Pow
+                && Precedence(oper.back()) >= Precedence(x)
+                //                // or (the operator at the top of the operator stack has equal precedence and is left associative)) - ???
+                //                || (   Precedence(oper.back()) == Precedence(x)
+                //                    && oper.back() != TOKEN::Pow)//'^' is right associative
+                                // and (the operator at the top of the operator stack is not a left parenthesis) :
+                )
             {
                 //pop operators from the operator stack onto the output queue.
-                postfix.push(oper.top());
-                LOGD("push: %s\n", oper.top().sval.c_str());
-                oper.pop();
+                postfix.push_back(oper.back());
+                LOGD("push: %s\n", TokenName(oper.back()));
+                oper.pop_back();
             }
             //push it onto the operator stack.
-            oper.push(x);
+            oper.push_back(x);
         }
-        else if (x.tok == TOKENS::Expr && x.sval[0] == '(') {
+        else if (x == TOKEN::LParen) {
             //if the token is a left paren(i.e. "("), then :
             //push it onto the operator stack.
-            oper.push(x);
+            oper.push_back(x);
         }
-        else if (x.tok == TOKENS::Expr && x.sval[0] == ')') {
+        else if (x == TOKEN::RParen) {
             //if the token is a right paren(i.e. ")"), then :
             //while the operator at the top of the operator stack is not a left paren :
-            while (oper.top().sval[0] != '(') {
+            while (oper.back() != TOKEN::LParen) {
                 //pop the operator from the operator stack onto the output queue.
-                postfix.push(oper.top());
-                LOGD("push: %s\n", oper.top().sval.c_str());
-                oper.pop();
+                postfix.push_back(oper.back());
+                LOGD("push: %s\n", TokenName(oper.back()));
+                oper.pop_back();
             }
             /* if the stack runs out without finding a left paren, then there are mismatched parentheses. */
             //if there is a left paren at the top of the operator stack, then :
-            if (oper.top().sval[0] == '(') {
+            if (oper.back() == TOKEN::LParen) {
                 //pop the operator from the operator stackand discard it
-                oper.pop();
+                oper.pop_back();
+            }
+            //if there is a function token at the top of the operator stack, then :
+            if (oper.size() && oper.back() >= TOKEN::Sqrt) {
+                //pop the function from the operator stack onto the output queue,
+                //min and max were output at their commas already.
+                if (oper.back() < TOKEN::Min) {
+                    postfix.push_back(oper.back());
+                    LOGD("push: %s\n", TokenName(oper.back()));
+                }
+                oper.pop_back();
             }
         }
     }
@@ -180,71 +364,63 @@ void CCalculator::InfixToPostfix()
     while (oper.size()) {
         /* if the operator token on the top of the stack is a paren, then there are mismatched parentheses. */
         //pop the operator from the operator stack onto the output queue.
-        postfix.push(oper.top());
-        LOGD("push: %s\n", oper.top().sval.c_str());
-        oper.pop();
+        postfix.push_back(oper.back());
+        LOGD("push: %s\n", TokenName(oper.back()));
+        oper.pop_back();
     }
     //exit.
 }
 
-double CCalculator::CalculateOperation(CToken& op, CToken& a, CToken& b)
-{
-    double result = 0;
-    switch (op.sval[0]) {
-    case '+':
-        result = a.dval + b.dval;
-        break;
-    case '-':
-        result = a.dval - b.dval;
-        break;
-    case '*':
-        result = a.dval * b.dval;
-        break;
-    case '/':
-        result = a.dval / b.dval;
-        break;
-    case '^':
-        result = pow(a.dval, b.dval);
-        break;
-    }
-    LOGD("%f%c%f=%f\n", a.dval, op.sval[0], b.dval, result);
-    return result;
-}
-
-double CCalculator::PostfixEvaluate()
+void CCalculator::PostfixToProgram(CCompiledExpression& prog)
 {
     //written due to wikipedia article
     //https://en.wikipedia.org/wiki/Reverse_Polish_notation
-    stack<CToken> oper;
-    //for each token in the postfix expression :
-    while (postfix.size()) {
-        CToken& t = postfix.front();
-        //if token is an operator :
-        if (t.tok == TOKENS::Operator) {
-            //operand_2 ← pop from the stack
-            CToken& b = oper.top();
-            oper.pop();
-            //operand_1 ← pop from the stack
-            CToken& a = oper.top();
-            oper.pop();
-            //result ← evaluate token with operand_1and operand_2
-            CToken c;
-            c.tok = TOKENS::Number;
-            c.dval = CalculateOperation(t, a, b);
-            //push result back onto the stack
-            oper.push(c);
-        }
-        //else if token is an operand :
-        else if (t.tok == TOKENS::Number) {
-            //push token onto the stack
-            oper.push(t);
-        }
-        postfix.pop();
-    }
-    //result ← pop from the stack
-    double result = oper.top().dval;
-    oper.pop();
-    return result;
+    //the postfix queue is already in evaluation order
+    prog.Clear();
+    size_t number = 0;
+    size_t name = 0;
+    for (TOKEN t : postfix) {
+        switch (t) {
+        case TOKEN::Number:
+            prog.EmitConst(numbers[number++]);
+            break;
+        case TOKEN::Variable:
+            prog.EmitVariable(names[name++]);
+            break;
+        case TOKEN::Add:
+            prog.EmitOperation(OPCODE::Add);
+            break;
+        case TOKEN::Sub:
+            prog.EmitOperation(OPCODE::Sub);
+            break;
+        case TOKEN::Mul:
+            prog.EmitOperation(OPCODE::Mul);
+            break;
+        case TOKEN::Div:
+            prog.EmitOperation(OPCODE::Div);
+            break;
+        case TOKEN::Pow:
+            prog.EmitOperation(OPCODE::Pow);
+            break;
+        case TOKEN::Min:
+            prog.EmitOperation(OPCODE::Min);
+            break;
+        case TOKEN::Max:
+            prog.EmitOperation(OPCODE::Max);
+            break;
+        case TOKEN::Sqrt:
+        case TOKEN::Abs:
+        case TOKEN::Exp:
+        case TOKEN::Log:
+        case TOKEN::Sin:
+        case TOKEN::Cos:
+            prog.EmitOperation((OPCODE)((int)OPCODE::Sqrt + (int)t - (int)TOKEN::Sqrt));
+            break;
+        default:
+            break;
+        }
+    }
+    LOGD("program size=%d stack depth=%d\n", (int)prog.Size(), prog.m_depth);
 }
 
 CCalculator::CCalculator()
@@ -282,6 +458,91 @@ string CCalculator::GetExpression()
     return expr;
 }
 
+int CCalculator::Compile(string_view expr, CCompiledExpression& prog)
+{
+    int res;
+    {
+        PROFILE_SCOPE(STAGE_TOKENIZE);
+        res = ParseStringToInfix(expr, 0, expr.length());
+    }
+    PROFILE_RECORD(VALUE_EXPR_LENGTH, expr.length());
+    PROFILE_RECORD(VALUE_EXPR_TOKENS, infix.size());
+    if (res == CALC_OK) {
+        {
+            PROFILE_SCOPE(STAGE_INFIX_TO_POSTFIX);
+            InfixToPostfix();
+        }
+        {
+            PROFILE_SCOPE(STAGE_COMPILE);
+            PostfixToProgram(prog);
+        }
+        if (optimization != OPT_NONE) {
+            PROFILE_SCOPE(STAGE_OPTIMIZE);
+            tree.Build(prog);
+            tree.Optimize(optimization);
+            tree.Lower(prog);
+        }
+        prog.m_fast = (optimization & OPT_FAST_MATH) != 0;
+    }
+    return res;
+}
+
+int CCalculator::Dump(string_view expr, string& out)
+{
+    int res = Compile(expr, program);
+    if (res == CALC_OK) {
+        //Compile() leaves the optimized tree behind
+        if (optimization == OPT_NONE) {
+            tree.Build(program);
+        }
+        out += "tree: ";
+        tree.Dump(out);
+        out += " program: ";
+        program.Disassemble(out);
+    }
+    return res;
+}
+
+void CCalculator::SetCache(size_t capacity)
+{
+    if (capacity) {
+        cache.reset(new CResultCache(capacity));
+    }
+    else {
+        cache.reset();
+    }
+}
+
+int CCalculator::Evaluate(string_view expr, double& result)
+{
+    PROFILE_SCOPE(STAGE_TOTAL);
+    int res;
+    if (cache) {
+        CResultCache::Normalize(expr, cache_key);
+        if (cache->Find(cache_key, result, res)) {
+            return res;
+        }
+    }
+    //the member program keeps its capacity between expressions
+    res = Compile(expr, program);
+    if (res == CALC_OK && program.Variables().size()) {
+        res = CALC_ERR_VARIABLE;
+    }
+    if (res == CALC_OK && backend == BACKEND::Threaded) {
+        PROFILE_SCOPE(STAGE_EVALUATE);
+        threaded.Compile(program);
+        result = threaded.Evaluate();
+    }
+    else if (res == CALC_OK) {
+        PROFILE_SCOPE(STAGE_EVALUATE);
+        result = program.Evaluate();
+    }
+    if (cache) {
+        cache->Insert(cache_key, result, res);
+    }
+    return res;
+}
+
 int CCalculator::Run(bool test)
 {
     cout << COLOR_YELLOW_TEXT "This is a simple line expression calculator." COLOR_END << endl;
@@ -314,30 +575,160 @@ int CCalculator::Run(bool test)
                 return 0;
             }
         } else {
-            infix.clear();
-            int res = ParseStringToInfix(expr, 0, expr.length());
-            if (res == 0) {
-                InfixToPostfix();
-                double result = PostfixEvaluate();
-                cout << COLOR_GREEN_TEXT "result = " << result << COLOR_END << endl << endl;
+            if (dump) {
+                string text;
+                if (Dump(expr, text) == CALC_OK) {
+                    cout << COLOR_L_BLUE_TEXT << text << COLOR_END << endl;
+                }
+            }
+            double result = 0;
+            int res = Evaluate(expr, result);
+            if (res == CALC_OK) {
+                char num[64];
+                int len = FormatResult(num, sizeof(num), result);
+                cout << COLOR_GREEN_TEXT "result = " << string_view(num, len) << COLOR_END << endl << endl;
+            }
+            else {
+                cout << COLOR_RED_TEXT << CalcErrorString(res) << COLOR_END << endl << endl;
+            }
+            if (test && CAllocCounter::Enabled()) {
+                //the buffers are warm now, tokenizing the same expression again must not allocate
+                uint64_t allocs = CAllocCounter::Get();
+                ParseStringToInfix(expr, 0, (unsigned int)expr.length());
+                cout << COLOR_L_BLUE_TEXT "tokenizer allocations = " << CAllocCounter::Get() - allocs << COLOR_END << endl << endl;
             }
         }
     }
     return 0;
 }
 
-int CCalculator::ParseStringToInfix(string& expr, unsigned int start, unsigned int length)
+int FormatResult(char* buf, size_t size, double value)
+{
+    auto r = to_chars(buf, buf + size, value);
+    return r.ec == errc() ? (int)(r.ptr - buf) : 0;
+}
+
+//little-endian on every host
+static void AppendLE(string& out, uint64_t v)
+{
+    char b[8];
+    for (int i = 0; i < 8; i++) {
+        b[i] = (char)(v >> (8 * i));
+    }
+    out.append(b, 8);
+}
+
+static void PatchGroup(string& out, size_t group, uint32_t count, uint64_t errors)
+{
+    for (int i = 0; i < 4; i++) {
+        out[group + i] = (char)(count >> (8 * i));
+    }
+    for (int i = 0; i < 8; i++) {
+        out[group + 8 + i] = (char)(errors >> (8 * i));
+    }
+}
+
+void AppendResultGroups(string& out, const double* values, size_t count)
+{
+    for (size_t i = 0; i < count; i += RESULT_BIN_GROUP) {
+        uint32_t n = (uint32_t)min((size_t)RESULT_BIN_GROUP, count - i);
+        AppendLE(out, n);
+        AppendLE(out, 0);
+        for (uint32_t j = 0; j < n; j++) {
+            uint64_t bits;
+            memcpy(&bits, &values[i + j], sizeof(bits));
+            AppendLE(out, bits);
+        }
+    }
+}
+
+void CCalculator::EvaluateLines(string_view text, string& out)
+{
+    char num[64];
+    size_t pos = 0;
+    //binary group in work
+    bool binary = output == OUTPUT_FORMAT::Binary && !dump;
+    size_t group = 0;
+    uint32_t count = 0;
+    uint64_t errors = 0;
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        if (end == string_view::npos) {
+            end = text.size();
+        }
+        string_view line = text.substr(pos, end - pos);
+        pos = end + 1;
+        //accept CRLF input and the interactive trailing '='
+        if (line.size() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        if (line.size() && line.back() == '=') {
+            line.remove_suffix(1);
+        }
+        bool blank = line.find_first_not_of(" \t") == string_view::npos;
+        if (binary) {
+            if (count == 0) {
+                group = out.size();
+                out.append(16, '\0');
+                errors = 0;
+            }
+            double result = 0;
+            int res = blank ? CALC_ERR_EMPTY : Evaluate(line, result);
+            if (res != CALC_OK) {
+                errors |= 1ULL << count;
+                result = res;
+            }
+            uint64_t bits;
+            memcpy(&bits, &result, sizeof(bits));
+            AppendLE(out, bits);
+            if (++count == RESULT_BIN_GROUP) {
+                PatchGroup(out, group, count, errors);
+                count = 0;
+            }
+            continue;
+        }
+        if (blank) {
+            //keep output lines aligned with input lines
+            out += '\n';
+            continue;
+        }
+        double result = 0;
+        int res = dump ? Dump(line, out) : Evaluate(line, result);
+        if (res == CALC_OK && dump) {
+            out += '\n';
+        }
+        else if (res == CALC_OK) {
+            int len = FormatResult(num, sizeof(num) - 1, result);
+            num[len++] = '\n';
+            out.append(num, len);
+        }
+        else {
+            out += "error: ";
+            out += CalcErrorString(res);
+            out += '\n';
+        }
+    }
+    if (count) {
+        PatchGroup(out, group, count, errors);
+    }
+}
+
+int CCalculator::ParseStringToInfix(string_view expr, unsigned int start, unsigned int length)
 {
     CToken token;
-    LOGD("before: expr = %s, length=%d\n", expr.c_str(), length);
+    LOGD("before: expr = %.*s, length=%d\n", (int)expr.size(), expr.data(), length);
+    infix.clear();
+    numbers.clear();
+    names.clear();
     while (start < length) {
-        start = GetToken(expr, start, token);
-        if (start < 0) {
-            cout << COLOR_RED_TEXT "Wrong operation sign." COLOR_END << endl << endl;
-            return -1;
+        bool sign = infix.size() && (infix.back() == TOKEN::LParen || infix.back() == TOKEN::Comma);
+        int next = GetToken(expr, start, sign, token);
+        if (next < 0) {
+            return next;
         }
-        else if (start > 0) {
-            infix.push_back(token);
+        else if (next > 0) {
+            AppendToken(token);
+            start = next;
         }
         else {
             //trailing spaces
@@ -345,27 +736,66 @@ int CCalculator::ParseStringToInfix(string& expr, unsigned int start, unsigned i
             break;
         }
     }
-    //check parenthesis number
+    if (infix.empty()) {
+        return CALC_ERR_EMPTY;
+    }
+    //check parenthesis nesting
     int cnt = 0;
-    for (auto & t : infix) {
-        if (t.sval[0] == '(') cnt++;
-        else if (t.sval[0] == ')') cnt--;
+    for (TOKEN t : infix) {
+        if (t == TOKEN::LParen) cnt++;
+        else if (t == TOKEN::RParen && --cnt < 0) break;
     }
     if (cnt) {
-        cout << COLOR_RED_TEXT "Wrong number of parenthesis." COLOR_END << endl << endl;
-        return -1;
+        return CALC_ERR_PARENTHESIS;
     }
-    //check expression order
-    int op_cnt = 0;
-    int num_cnt = 0;
-    for (auto& t : infix) {
-        if (t.tok == TOKENS::Number) num_cnt++;
-        else if (t.tok == TOKENS::Operator) op_cnt++;
+    //check expression order: operands and operators have to alternate,
+    //otherwise CCompiledExpression::Evaluate() would run out of operands.
+    //A function stands where an operand is expected, its '(' always follows it;
+    //commas separate operands directly inside the parenthesis of a function.
+    bool operand = true;
+    parens.clear();
+    for (size_t i = 0; i < infix.size(); i++) {
+        TOKEN t = infix[i];
+        bool ok;
+        if (t == TOKEN::Number || t == TOKEN::Variable) {
+            ok = operand;
+            operand = false;
+        }
+        else if (t >= TOKEN::Sqrt) {
+            ok = operand;
+        }
+        else if (t >= TOKEN::Add && t <= TOKEN::Pow) {
+            ok = !operand;
+            operand = true;
+        }
+        else if (t == TOKEN::LParen) {
+            ok = operand;
+            parens.push_back({ i && infix[i - 1] >= TOKEN::Sqrt ? infix[i - 1] : TOKEN::LParen, 1 });
+        }
+        else if (t == TOKEN::Comma) {
+            ok = !operand && parens.size() && parens.back().func != TOKEN::LParen;
+            operand = true;
+            if (ok) {
+                parens.back().args++;
+            }
+        }
+        else {
+            ok = !operand;
+            //min and max take one or more arguments, the other functions one
+            if (ok && parens.back().func < TOKEN::Min && parens.back().args != 1) {
+                //LOGE() evaluates its arguments only when the site is on, the rescan is const
+                LOGE("Wrong number of arguments at %u: %.*s\n", TokenOffset(expr, i), (int)expr.size(), expr.data());
+                return CALC_ERR_ARGUMENTS;
+            }
+            parens.pop_back();
+        }
+        if (!ok) {
+            LOGE("Wrong expression at %u: %.*s\n", TokenOffset(expr, i), (int)expr.size(), expr.data());
+            return CALC_ERR_EXPRESSION;
+        }
     }
-    if (num_cnt - op_cnt != 1) {
-        cout << COLOR_RED_TEXT "Wrong expression." COLOR_END << endl << endl;
-        return -1;
+    if (operand) {
+        return CALC_ERR_EXPRESSION;
     }
-    return 0;
+    return CALC_OK;
 }
-
@@ -1,40 +1,145 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
-#include <queue>
+#include <memory>
+
+#include "CCompiledExpression.h"
+#include "CExprTree.h"
+#include "CThreadedProgram.h"
+#include "CResultCache.h"
 
 using namespace std;
 
+enum CALC_ERROR {
+	CALC_OK = 0,
+	CALC_ERR_EMPTY = -1,
+	CALC_ERR_OPERATION = -2,
+	CALC_ERR_SYMBOL = -3,
+	CALC_ERR_PARENTHESIS = -4,
+	CALC_ERR_EXPRESSION = -5,
+	CALC_ERR_VARIABLE = -6,
+	CALC_ERR_CYCLE = -7,
+	CALC_ERR_FUNCTION = -8,
+	CALC_ERR_ARGUMENTS = -9,
+	CALC_ERR_RANGE = -10
+};
+
+const char* CalcErrorString(int err);
+
+//shortest text that reads back to the same double, returns its length
+int FormatResult(char* buf, size_t size, double value);
+
+//how EvaluateLines() writes results
+enum class OUTPUT_FORMAT {
+	Text,   //one result or "error: <message>" line per input line
+	Binary  //RESULT_BIN_xxx below
+};
+
+//Binary results: the RESULT_BIN_MAGIC header (written once by the batch processor),
+//then groups of up to RESULT_BIN_GROUP lines, every number little-endian:
+//u32 count, u32 0, u64 error bitmap (bit i: line i failed), count doubles.
+//A failed or blank line carries its CALC_ERROR code as the double.
+#define RESULT_BIN_MAGIC "CALCRES1"
+#define RESULT_BIN_GROUP 64
+
+//binary groups of count results without errors
+void AppendResultGroups(string& out, const double* values, size_t count);
+
 class CCalculator
 {
-	enum class TOKENS {
-		Unknown,
-		Function,
-		Operator,
+	//micro-benchmarks of the pipeline stages
+	friend class CCalcBench;
+
+	//kind of a token, operators and functions carry their operation
+	enum class TOKEN : uint8_t {
 		Number,
-		Expr
+		Variable,
+		Add, //operators
+		Sub,
+		Mul,
+		Div,
+		Pow,
+		LParen,
+		RParen,
+		Comma,
+		Sqrt, //functions
+		Abs,
+		Exp,
+		Log,
+		Sin,
+		Cos,
+		Min,
+		Max
 	};
 
+	//one token as returned by GetToken()
 	struct CToken {
-		TOKENS tok;
-		double dval;
-		string sval;
+		TOKEN code;
+		double dval;      //number value
+		string_view sval; //token text, points into the parsed expression
+	};
+
+	//open parenthesis while ParseStringToInfix() checks the expression
+	struct SParen {
+		TOKEN func;    //function it belongs to, LParen for a plain one
+		uint32_t args; //arguments seen so far
 	};
 
 private:
 	//members
-	vector<CToken> infix;
-	queue<CToken> postfix;
+	//Token streams as parallel arrays: a code byte per token, the values of the numbers
+	//and the names of the variables in source order. Operands keep their order from infix
+	//to postfix, so both streams read them from the same arrays.
+	//Source offsets are not kept, TokenOffset() finds them again for error messages.
+	vector<TOKEN> infix;
+	vector<TOKEN> postfix;
+	vector<double> numbers;
+	vector<string_view> names;
+	vector<TOKEN> opstack;
+	vector<SParen> parens;
+	CCompiledExpression program;
+	CExprTree tree;
+	CThreadedProgram threaded;
+	BACKEND backend = BACKEND::Interpreter;
+	unsigned int optimization = OPT_DEFAULT;
+	bool dump = false;
+	OUTPUT_FORMAT output = OUTPUT_FORMAT::Text;
+	unique_ptr<CResultCache> cache;
+	string cache_key;
 	//methods
 	string GetExpression();
-	unsigned int GetToken(const string& expr, unsigned int start, CToken& token);
-	int ParseStringToInfix(string& expr, unsigned int start, unsigned int end);
+	static int Precedence(TOKEN code);
+	//operator or function text for the debug log
+	static const char* TokenName(TOKEN code);
+	//sign: a minus may be the sign of a number, after '(' and ','
+	int GetToken(string_view expr, unsigned int start, bool sign, CToken& token) const;
+	void AppendToken(const CToken& token);
+	unsigned int TokenOffset(string_view expr, size_t idx) const;
+	int ParseStringToInfix(string_view expr, unsigned int start, unsigned int end);
 	void InfixToPostfix();
-	double PostfixEvaluate();
-	double CalculateOperation(CToken& op, CToken& a, CToken& b);
+	void PostfixToProgram(CCompiledExpression& prog);
 public:
 	CCalculator();
 	~CCalculator();
 	int Run(bool test);
+	//evaluates every line of text and appends one result or error line per input line to out
+	void EvaluateLines(string_view text, string& out);
+	int Evaluate(string_view expr, double& result);
+	//parse and convert expr once, the result can be evaluated many times
+	int Compile(string_view expr, CCompiledExpression& prog);
+	//put a LRU cache of capacity entries in front of Evaluate(), 0 disables it
+	void SetCache(size_t capacity);
+	const CResultCache* Cache() const { return cache.get(); }
+	//OPT_xxx flags used by Compile()
+	void SetOptimization(unsigned int flags) { optimization = flags; }
+	//evaluator used by Evaluate()
+	void SetBackend(BACKEND val) { backend = val; }
+	//print the optimized form of every expression in Run() and EvaluateLines()
+	void SetDump(bool val) { dump = val; }
+	//result format of EvaluateLines(), the dump is always text
+	void SetOutput(OUTPUT_FORMAT val) { output = val; }
+	//optimized tree and program of expr
+	int Dump(string_view expr, string& out);
 };
 
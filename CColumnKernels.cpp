@@ -0,0 +1,586 @@
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "CColumnKernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define COLUMN_KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif //_MSC_VER
+#endif
+
+#if defined(__GNUC__)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+//constants of the fast kernels
+#define FM_ROUND 6755399441055744.0 //1.5 * 2^52: x + FM_ROUND - FM_ROUND rounds x to an integer
+#define FM_TWO52 4503599627370496.0
+#define FM_TWO54 18014398509481984.0
+#define FM_LOG2E 1.4426950408889634
+#define FM_LN2_HI 6.93147180369123816490e-01 //ln 2 in two parts, n * FM_LN2_HI is exact
+#define FM_LN2_LO 1.90821492927058770002e-10
+#define FM_EXP_MAX 709.782712893383973096    //ln DBL_MAX
+#define FM_EXP_MIN -708.0
+#define FM_SQRT2 1.4142135623730951
+#define FM_2_PI 0.63661977236758134308
+#define FM_PIO2_1 1.57079632673412561417e+00 //pi/2 in three 33 bit parts, k * FM_PIO2_x is exact for |x| <= FM_TRIG_MAX
+#define FM_PIO2_2 6.07710050630396597660e-11
+#define FM_PIO2_3 2.02226624871116645580e-21
+#define FM_TRIG_MAX 1e5
+#define FM_EXP_TERMS 14
+#define FM_LOG_TERMS 10
+#define FM_SIN_TERMS 7
+#define FM_COS_TERMS 9
+
+//Taylor coefficients, highest power first:
+//e^r for |r| <= ln2/2 up to r^13, log m = 2s(1 + s^2/3 + ... + s^20/21) with s = (m-1)/(m+1),
+//sin r and cos r for |r| <= pi/4 up to r^15 and r^16
+static const double expC[FM_EXP_TERMS] = { 1.0 / 6227020800.0, 1.0 / 479001600.0, 1.0 / 39916800.0, 1.0 / 3628800.0,
+    1.0 / 362880.0, 1.0 / 40320.0, 1.0 / 5040.0, 1.0 / 720.0, 1.0 / 120.0, 1.0 / 24.0, 1.0 / 6.0, 0.5, 1.0, 1.0 };
+static const double logC[FM_LOG_TERMS] = { 1.0 / 21, 1.0 / 19, 1.0 / 17, 1.0 / 15, 1.0 / 13, 1.0 / 11, 1.0 / 9,
+    1.0 / 7, 1.0 / 5, 1.0 / 3 };
+static const double sinC[FM_SIN_TERMS] = { -1.0 / 1307674368000.0, 1.0 / 6227020800.0, -1.0 / 39916800.0,
+    1.0 / 362880.0, -1.0 / 5040.0, 1.0 / 120.0, -1.0 / 6.0 };
+static const double cosC[FM_COS_TERMS] = { 1.0 / 20922789888000.0, -1.0 / 87178291200.0, 1.0 / 479001600.0,
+    -1.0 / 3628800.0, 1.0 / 40320.0, -1.0 / 720.0, 1.0 / 24.0, -0.5, 1.0 };
+
+static inline uint64_t Bits(double x)
+{
+    uint64_t b;
+    memcpy(&b, &x, sizeof(b));
+    return b;
+}
+
+static inline double Double(uint64_t b)
+{
+    double x;
+    memcpy(&x, &b, sizeof(x));
+    return x;
+}
+
+//the SIMD kernels below repeat these operations in this order, keep them in step
+double FastExp(double x)
+{
+    if (x != x) {
+        return x;
+    }
+    if (x > FM_EXP_MAX) {
+        return INFINITY;
+    }
+    if (x < FM_EXP_MIN) {
+        return 0;
+    }
+    //e^x = 2^n * e^r, r = x - n * ln2
+    double t = x * FM_LOG2E + FM_ROUND;
+    double n = t - FM_ROUND;
+    double r = (x - n * FM_LN2_HI) - n * FM_LN2_LO;
+    double p = expC[0];
+    for (int i = 1; i < FM_EXP_TERMS; i++) {
+        p = p * r + expC[i];
+    }
+    //n is in the low bits of t, added to the exponent of p
+    return Double(Bits(p) + ((Bits(t) - Bits(FM_ROUND)) << 52));
+}
+
+double FastLog(double x)
+{
+    if (x != x) {
+        return x;
+    }
+    if (x < 0) {
+        return NAN;
+    }
+    if (x == 0) {
+        return -INFINITY;
+    }
+    if (x == INFINITY) {
+        return x;
+    }
+    //log x = e * ln2 + log m, sqrt(1/2) < m <= sqrt(2)
+    double bias = 1023;
+    if (x < DBL_MIN) {
+        x = x * FM_TWO54;
+        bias = 1023 + 54;
+    }
+    uint64_t b = Bits(x);
+    double e = Double((b >> 52) | Bits(FM_TWO52)) - FM_TWO52 - bias;
+    double m = Double((b & 0x000fffffffffffffULL) | Bits(1.0));
+    if (m > FM_SQRT2) {
+        m = m * 0.5;
+        e = e + 1;
+    }
+    double s = (m - 1) / (m + 1);
+    double z = s * s;
+    double p = logC[0];
+    for (int i = 1; i < FM_LOG_TERMS; i++) {
+        p = p * z + logC[i];
+    }
+    double s2 = s + s;
+    double lm = s2 + s2 * z * p;
+    return e * FM_LN2_HI + (lm + e * FM_LN2_LO);
+}
+
+//sin x for q0 = 0, cos x = sin(x + pi/2) for q0 = 1
+static double FastSinCos(double x, uint64_t q0)
+{
+    if (!(fabs(x) <= FM_TRIG_MAX)) {
+        return q0 ? cos(x) : sin(x);
+    }
+    if (x == 0) {
+        //keeps the sign of sin(-0)
+        return q0 ? 1 : x;
+    }
+    //x = k * pi/2 + r, the quadrant k decides between sin r and cos r and the sign
+    double t = x * FM_2_PI + FM_ROUND;
+    double k = t - FM_ROUND;
+    double r = ((x - k * FM_PIO2_1) - k * FM_PIO2_2) - k * FM_PIO2_3;
+    uint64_t q = Bits(t) - Bits(FM_ROUND) + q0;
+    double z = r * r;
+    double s = sinC[0];
+    for (int i = 1; i < FM_SIN_TERMS; i++) {
+        s = s * z + sinC[i];
+    }
+    s = r + r * z * s;
+    double c = cosC[0];
+    for (int i = 1; i < FM_COS_TERMS; i++) {
+        c = c * z + cosC[i];
+    }
+    double res = (q & 1) ? c : s;
+    return (q & 2) ? -res : res;
+}
+
+double FastSin(double x)
+{
+    return FastSinCos(x, 0);
+}
+
+double FastCos(double x)
+{
+    return FastSinCos(x, 1);
+}
+
+//scalar kernels
+static void FillScalar(double* a, double val, size_t n)
+{
+    for (size_t i = 0; i < n; i++) a[i] = val;
+}
+
+#define SCALAR_BINARY(name, op) \
+static void name(double* a, const double* b, size_t n) \
+{ \
+    for (size_t i = 0; i < n; i++) a[i] = a[i] op b[i]; \
+}
+
+SCALAR_BINARY(AddScalar, +)
+SCALAR_BINARY(SubScalar, -)
+SCALAR_BINARY(MulScalar, *)
+SCALAR_BINARY(DivScalar, /)
+
+static void MinScalar(double* a, const double* b, size_t n)
+{
+    for (size_t i = 0; i < n; i++) a[i] = MinOf(a[i], b[i]);
+}
+
+static void MaxScalar(double* a, const double* b, size_t n)
+{
+    for (size_t i = 0; i < n; i++) a[i] = MaxOf(a[i], b[i]);
+}
+
+#define SCALAR_UNARY(name, fn) \
+static void name(double* a, size_t n) \
+{ \
+    for (size_t i = 0; i < n; i++) a[i] = fn(a[i]); \
+}
+
+SCALAR_UNARY(SqrtScalar, sqrt)
+SCALAR_UNARY(AbsScalar, fabs)
+SCALAR_UNARY(ExpScalar, exp)
+SCALAR_UNARY(LogScalar, log)
+SCALAR_UNARY(SinScalar, sin)
+SCALAR_UNARY(CosScalar, cos)
+SCALAR_UNARY(FastExpScalar, FastExp)
+SCALAR_UNARY(FastLogScalar, FastLog)
+SCALAR_UNARY(FastSinScalar, FastSin)
+SCALAR_UNARY(FastCosScalar, FastCos)
+
+#ifdef COLUMN_KERNELS_X86
+//SSE2 kernels, 2 doubles per operation
+TARGET_SSE2 static void FillSSE2(double* a, double val, size_t n)
+{
+    __m128d v = _mm_set1_pd(val);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) _mm_storeu_pd(a + i, v);
+    for (; i < n; i++) a[i] = val;
+}
+
+#define SSE2_BINARY(name, intr, op) \
+TARGET_SSE2 static void name(double* a, const double* b, size_t n) \
+{ \
+    size_t i = 0; \
+    for (; i + 4 <= n; i += 4) { \
+        __m128d x0 = intr(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)); \
+        __m128d x1 = intr(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)); \
+        _mm_storeu_pd(a + i, x0); \
+        _mm_storeu_pd(a + i + 2, x1); \
+    } \
+    for (; i < n; i++) a[i] = a[i] op b[i]; \
+}
+
+SSE2_BINARY(AddSSE2, _mm_add_pd, +)
+SSE2_BINARY(SubSSE2, _mm_sub_pd, -)
+SSE2_BINARY(MulSSE2, _mm_mul_pd, *)
+SSE2_BINARY(DivSSE2, _mm_div_pd, /)
+
+//m ? a : b, m is all ones or all zeros per lane
+#define SSE2_SELECT(m, a, b) _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b))
+
+//_mm_min_pd(a, b) is a < b ? a : b, a NaN in a is kept as MinOf() does
+#define SSE2_MINMAX(name, intr, scalar) \
+TARGET_SSE2 static void name(double* a, const double* b, size_t n) \
+{ \
+    size_t i = 0; \
+    for (; i + 2 <= n; i += 2) { \
+        __m128d x = _mm_loadu_pd(a + i); \
+        __m128d r = intr(x, _mm_loadu_pd(b + i)); \
+        _mm_storeu_pd(a + i, SSE2_SELECT(_mm_cmpunord_pd(x, x), x, r)); \
+    } \
+    for (; i < n; i++) a[i] = scalar(a[i], b[i]); \
+}
+
+SSE2_MINMAX(MinSSE2, _mm_min_pd, MinOf)
+SSE2_MINMAX(MaxSSE2, _mm_max_pd, MaxOf)
+
+TARGET_SSE2 static inline __m128d AbsSSE2(__m128d x)
+{
+    return _mm_and_pd(x, _mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffffLL)));
+}
+
+TARGET_SSE2 static inline __m128d ExpSSE2(__m128d x)
+{
+    const __m128d round = _mm_set1_pd(FM_ROUND);
+    __m128d t = _mm_add_pd(_mm_mul_pd(x, _mm_set1_pd(FM_LOG2E)), round);
+    __m128d n = _mm_sub_pd(t, round);
+    __m128d r = _mm_sub_pd(_mm_sub_pd(x, _mm_mul_pd(n, _mm_set1_pd(FM_LN2_HI))), _mm_mul_pd(n, _mm_set1_pd(FM_LN2_LO)));
+    __m128d p = _mm_set1_pd(expC[0]);
+    for (int i = 1; i < FM_EXP_TERMS; i++) {
+        p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(expC[i]));
+    }
+    __m128i e = _mm_slli_epi64(_mm_sub_epi64(_mm_castpd_si128(t), _mm_castpd_si128(round)), 52);
+    __m128d res = _mm_castsi128_pd(_mm_add_epi64(_mm_castpd_si128(p), e));
+    res = SSE2_SELECT(_mm_cmplt_pd(x, _mm_set1_pd(FM_EXP_MIN)), _mm_setzero_pd(), res);
+    res = SSE2_SELECT(_mm_cmpgt_pd(x, _mm_set1_pd(FM_EXP_MAX)), _mm_set1_pd(INFINITY), res);
+    return SSE2_SELECT(_mm_cmpunord_pd(x, x), x, res);
+}
+
+TARGET_SSE2 static inline __m128d LogSSE2(__m128d x)
+{
+    const __m128d two52 = _mm_set1_pd(FM_TWO52);
+    __m128d tiny = _mm_cmplt_pd(x, _mm_set1_pd(DBL_MIN));
+    __m128d xs = SSE2_SELECT(tiny, _mm_mul_pd(x, _mm_set1_pd(FM_TWO54)), x);
+    __m128d bias = SSE2_SELECT(tiny, _mm_set1_pd(1023 + 54), _mm_set1_pd(1023));
+    __m128i b = _mm_castpd_si128(xs);
+    __m128d e = _mm_castsi128_pd(_mm_or_si128(_mm_srli_epi64(b, 52), _mm_castpd_si128(two52)));
+    e = _mm_sub_pd(_mm_sub_pd(e, two52), bias);
+    __m128d m = _mm_castsi128_pd(_mm_or_si128(_mm_and_si128(b, _mm_set1_epi64x(0x000fffffffffffffLL)),
+        _mm_castpd_si128(_mm_set1_pd(1.0))));
+    __m128d big = _mm_cmpgt_pd(m, _mm_set1_pd(FM_SQRT2));
+    m = SSE2_SELECT(big, _mm_mul_pd(m, _mm_set1_pd(0.5)), m);
+    e = SSE2_SELECT(big, _mm_add_pd(e, _mm_set1_pd(1)), e);
+    const __m128d one = _mm_set1_pd(1);
+    __m128d s = _mm_div_pd(_mm_sub_pd(m, one), _mm_add_pd(m, one));
+    __m128d z = _mm_mul_pd(s, s);
+    __m128d p = _mm_set1_pd(logC[0]);
+    for (int i = 1; i < FM_LOG_TERMS; i++) {
+        p = _mm_add_pd(_mm_mul_pd(p, z), _mm_set1_pd(logC[i]));
+    }
+    __m128d s2 = _mm_add_pd(s, s);
+    __m128d lm = _mm_add_pd(s2, _mm_mul_pd(_mm_mul_pd(s2, z), p));
+    __m128d res = _mm_add_pd(_mm_mul_pd(e, _mm_set1_pd(FM_LN2_HI)), _mm_add_pd(lm, _mm_mul_pd(e, _mm_set1_pd(FM_LN2_LO))));
+    res = SSE2_SELECT(_mm_cmpeq_pd(x, _mm_set1_pd(INFINITY)), x, res);
+    res = SSE2_SELECT(_mm_cmpeq_pd(x, _mm_setzero_pd()), _mm_set1_pd(-INFINITY), res);
+    res = SSE2_SELECT(_mm_cmplt_pd(x, _mm_setzero_pd()), _mm_set1_pd(NAN), res);
+    return SSE2_SELECT(_mm_cmpunord_pd(x, x), x, res);
+}
+
+TARGET_SSE2 static inline __m128d SinCosSSE2(__m128d x, uint64_t q0)
+{
+    const __m128d round = _mm_set1_pd(FM_ROUND);
+    __m128d t = _mm_add_pd(_mm_mul_pd(x, _mm_set1_pd(FM_2_PI)), round);
+    __m128d k = _mm_sub_pd(t, round);
+    __m128d r = _mm_sub_pd(_mm_sub_pd(_mm_sub_pd(x, _mm_mul_pd(k, _mm_set1_pd(FM_PIO2_1))),
+        _mm_mul_pd(k, _mm_set1_pd(FM_PIO2_2))), _mm_mul_pd(k, _mm_set1_pd(FM_PIO2_3)));
+    __m128i q = _mm_add_epi64(_mm_sub_epi64(_mm_castpd_si128(t), _mm_castpd_si128(round)), _mm_set1_epi64x(q0));
+    __m128d z = _mm_mul_pd(r, r);
+    __m128d s = _mm_set1_pd(sinC[0]);
+    for (int i = 1; i < FM_SIN_TERMS; i++) {
+        s = _mm_add_pd(_mm_mul_pd(s, z), _mm_set1_pd(sinC[i]));
+    }
+    s = _mm_add_pd(r, _mm_mul_pd(_mm_mul_pd(r, z), s));
+    __m128d c = _mm_set1_pd(cosC[0]);
+    for (int i = 1; i < FM_COS_TERMS; i++) {
+        c = _mm_add_pd(_mm_mul_pd(c, z), _mm_set1_pd(cosC[i]));
+    }
+    //odd quadrant: all ones, bit 1 of the quadrant moved to the sign bit
+    __m128d odd = _mm_castsi128_pd(_mm_sub_epi64(_mm_setzero_si128(), _mm_and_si128(q, _mm_set1_epi64x(1))));
+    __m128d sign = _mm_castsi128_pd(_mm_slli_epi64(_mm_and_si128(q, _mm_set1_epi64x(2)), 62));
+    __m128d res = _mm_xor_pd(SSE2_SELECT(odd, c, s), sign);
+    return SSE2_SELECT(_mm_cmpeq_pd(x, _mm_setzero_pd()), q0 ? _mm_set1_pd(1) : x, res);
+}
+
+#define SSE2_UNARY(name, vector, scalar) \
+TARGET_SSE2 static void name(double* a, size_t n) \
+{ \
+    size_t i = 0; \
+    for (; i + 2 <= n; i += 2) _mm_storeu_pd(a + i, vector(_mm_loadu_pd(a + i))); \
+    for (; i < n; i++) a[i] = scalar(a[i]); \
+}
+
+SSE2_UNARY(SqrtSSE2, _mm_sqrt_pd, sqrt)
+SSE2_UNARY(AbsBlockSSE2, AbsSSE2, fabs)
+SSE2_UNARY(FastExpSSE2, ExpSSE2, FastExp)
+SSE2_UNARY(FastLogSSE2, LogSSE2, FastLog)
+
+//arguments out of the reduction range are done again by the C library
+#define SSE2_TRIG(name, q0, scalar) \
+TARGET_SSE2 static void name(double* a, size_t n) \
+{ \
+    size_t i = 0; \
+    for (; i + 2 <= n; i += 2) { \
+        __m128d x = _mm_loadu_pd(a + i); \
+        __m128d in = _mm_cmple_pd(AbsSSE2(x), _mm_set1_pd(FM_TRIG_MAX)); \
+        _mm_storeu_pd(a + i, SinCosSSE2(x, q0)); \
+        if (_mm_movemask_pd(in) != 0x3) { \
+            double v[2]; \
+            _mm_storeu_pd(v, x); \
+            a[i] = scalar(v[0]); \
+            a[i + 1] = scalar(v[1]); \
+        } \
+    } \
+    for (; i < n; i++) a[i] = scalar(a[i]); \
+}
+
+SSE2_TRIG(FastSinSSE2, 0, FastSin)
+SSE2_TRIG(FastCosSSE2, 1, FastCos)
+
+//AVX2 kernels, 4 doubles per operation
+TARGET_AVX2 static void FillAVX2(double* a, double val, size_t n)
+{
+    __m256d v = _mm256_set1_pd(val);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm256_storeu_pd(a + i, v);
+    for (; i < n; i++) a[i] = val;
+}
+
+#define AVX2_BINARY(name, intr, op) \
+TARGET_AVX2 static void name(double* a, const double* b, size_t n) \
+{ \
+    size_t i = 0; \
+    for (; i + 8 <= n; i += 8) { \
+        __m256d x0 = intr(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)); \
+        __m256d x1 = intr(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)); \
+        _mm256_storeu_pd(a + i, x0); \
+        _mm256_storeu_pd(a + i + 4, x1); \
+    } \
+    for (; i < n; i++) a[i] = a[i] op b[i]; \
+}
+
+AVX2_BINARY(AddAVX2, _mm256_add_pd, +)
+AVX2_BINARY(SubAVX2, _mm256_sub_pd, -)
+AVX2_BINARY(MulAVX2, _mm256_mul_pd, *)
+AVX2_BINARY(DivAVX2, _mm256_div_pd, /)
+
+#define AVX2_SELECT(m, a, b) _mm256_blendv_pd(b, a, m)
+
+#define AVX2_MINMAX(name, intr, scalar) \
+TARGET_AVX2 static void name(double* a, const double* b, size_t n) \
+{ \
+    size_t i = 0; \
+    for (; i + 4 <= n; i += 4) { \
+        __m256d x = _mm256_loadu_pd(a + i); \
+        __m256d r = intr(x, _mm256_loadu_pd(b + i)); \
+        _mm256_storeu_pd(a + i, AVX2_SELECT(_mm256_cmp_pd(x, x, _CMP_UNORD_Q), x, r)); \
+    } \
+    for (; i < n; i++) a[i] = scalar(a[i], b[i]); \
+}
+
+AVX2_MINMAX(MinAVX2, _mm256_min_pd, MinOf)
+AVX2_MINMAX(MaxAVX2, _mm256_max_pd, MaxOf)
+
+TARGET_AVX2 static inline __m256d AbsAVX2(__m256d x)
+{
+    return _mm256_and_pd(x, _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL)));
+}
+
+TARGET_AVX2 static inline __m256d ExpAVX2(__m256d x)
+{
+    const __m256d round = _mm256_set1_pd(FM_ROUND);
+    __m256d t = _mm256_add_pd(_mm256_mul_pd(x, _mm256_set1_pd(FM_LOG2E)), round);
+    __m256d n = _mm256_sub_pd(t, round);
+    __m256d r = _mm256_sub_pd(_mm256_sub_pd(x, _mm256_mul_pd(n, _mm256_set1_pd(FM_LN2_HI))),
+        _mm256_mul_pd(n, _mm256_set1_pd(FM_LN2_LO)));
+    __m256d p = _mm256_set1_pd(expC[0]);
+    for (int i = 1; i < FM_EXP_TERMS; i++) {
+        p = _mm256_add_pd(_mm256_mul_pd(p, r), _mm256_set1_pd(expC[i]));
+    }
+    __m256i e = _mm256_slli_epi64(_mm256_sub_epi64(_mm256_castpd_si256(t), _mm256_castpd_si256(round)), 52);
+    __m256d res = _mm256_castsi256_pd(_mm256_add_epi64(_mm256_castpd_si256(p), e));
+    res = AVX2_SELECT(_mm256_cmp_pd(x, _mm256_set1_pd(FM_EXP_MIN), _CMP_LT_OQ), _mm256_setzero_pd(), res);
+    res = AVX2_SELECT(_mm256_cmp_pd(x, _mm256_set1_pd(FM_EXP_MAX), _CMP_GT_OQ), _mm256_set1_pd(INFINITY), res);
+    return AVX2_SELECT(_mm256_cmp_pd(x, x, _CMP_UNORD_Q), x, res);
+}
+
+TARGET_AVX2 static inline __m256d LogAVX2(__m256d x)
+{
+    const __m256d two52 = _mm256_set1_pd(FM_TWO52);
+    __m256d tiny = _mm256_cmp_pd(x, _mm256_set1_pd(DBL_MIN), _CMP_LT_OQ);
+    __m256d xs = AVX2_SELECT(tiny, _mm256_mul_pd(x, _mm256_set1_pd(FM_TWO54)), x);
+    __m256d bias = AVX2_SELECT(tiny, _mm256_set1_pd(1023 + 54), _mm256_set1_pd(1023));
+    __m256i b = _mm256_castpd_si256(xs);
+    __m256d e = _mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(b, 52), _mm256_castpd_si256(two52)));
+    e = _mm256_sub_pd(_mm256_sub_pd(e, two52), bias);
+    __m256d m = _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(b, _mm256_set1_epi64x(0x000fffffffffffffLL)),
+        _mm256_castpd_si256(_mm256_set1_pd(1.0))));
+    __m256d big = _mm256_cmp_pd(m, _mm256_set1_pd(FM_SQRT2), _CMP_GT_OQ);
+    m = AVX2_SELECT(big, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), m);
+    e = AVX2_SELECT(big, _mm256_add_pd(e, _mm256_set1_pd(1)), e);
+    const __m256d one = _mm256_set1_pd(1);
+    __m256d s = _mm256_div_pd(_mm256_sub_pd(m, one), _mm256_add_pd(m, one));
+    __m256d z = _mm256_mul_pd(s, s);
+    __m256d p = _mm256_set1_pd(logC[0]);
+    for (int i = 1; i < FM_LOG_TERMS; i++) {
+        p = _mm256_add_pd(_mm256_mul_pd(p, z), _mm256_set1_pd(logC[i]));
+    }
+    __m256d s2 = _mm256_add_pd(s, s);
+    __m256d lm = _mm256_add_pd(s2, _mm256_mul_pd(_mm256_mul_pd(s2, z), p));
+    __m256d res = _mm256_add_pd(_mm256_mul_pd(e, _mm256_set1_pd(FM_LN2_HI)),
+        _mm256_add_pd(lm, _mm256_mul_pd(e, _mm256_set1_pd(FM_LN2_LO))));
+    res = AVX2_SELECT(_mm256_cmp_pd(x, _mm256_set1_pd(INFINITY), _CMP_EQ_OQ), x, res);
+    res = AVX2_SELECT(_mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_EQ_OQ), _mm256_set1_pd(-INFINITY), res);
+    res = AVX2_SELECT(_mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_LT_OQ), _mm256_set1_pd(NAN), res);
+    return AVX2_SELECT(_mm256_cmp_pd(x, x, _CMP_UNORD_Q), x, res);
+}
+
+TARGET_AVX2 static inline __m256d SinCosAVX2(__m256d x, uint64_t q0)
+{
+    const __m256d round = _mm256_set1_pd(FM_ROUND);
+    __m256d t = _mm256_add_pd(_mm256_mul_pd(x, _mm256_set1_pd(FM_2_PI)), round);
+    __m256d k = _mm256_sub_pd(t, round);
+    __m256d r = _mm256_sub_pd(_mm256_sub_pd(_mm256_sub_pd(x, _mm256_mul_pd(k, _mm256_set1_pd(FM_PIO2_1))),
+        _mm256_mul_pd(k, _mm256_set1_pd(FM_PIO2_2))), _mm256_mul_pd(k, _mm256_set1_pd(FM_PIO2_3)));
+    __m256i q = _mm256_add_epi64(_mm256_sub_epi64(_mm256_castpd_si256(t), _mm256_castpd_si256(round)),
+        _mm256_set1_epi64x(q0));
+    __m256d z = _mm256_mul_pd(r, r);
+    __m256d s = _mm256_set1_pd(sinC[0]);
+    for (int i = 1; i < FM_SIN_TERMS; i++) {
+        s = _mm256_add_pd(_mm256_mul_pd(s, z), _mm256_set1_pd(sinC[i]));
+    }
+    s = _mm256_add_pd(r, _mm256_mul_pd(_mm256_mul_pd(r, z), s));
+    __m256d c = _mm256_set1_pd(cosC[0]);
+    for (int i = 1; i < FM_COS_TERMS; i++) {
+        c = _mm256_add_pd(_mm256_mul_pd(c, z), _mm256_set1_pd(cosC[i]));
+    }
+    __m256d odd = _mm256_castsi256_pd(_mm256_sub_epi64(_mm256_setzero_si256(), _mm256_and_si256(q, _mm256_set1_epi64x(1))));
+    __m256d sign = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_and_si256(q, _mm256_set1_epi64x(2)), 62));
+    __m256d res = _mm256_xor_pd(AVX2_SELECT(odd, c, s), sign);
+    return AVX2_SELECT(_mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_EQ_OQ), q0 ? _mm256_set1_pd(1) : x, res);
+}
+
+#define AVX2_UNARY(name, vector, scalar) \
+TARGET_AVX2 static void name(double* a, size_t n) \
+{ \
+    size_t i = 0; \
+    for (; i + 4 <= n; i += 4) _mm256_storeu_pd(a + i, vector(_mm256_loadu_pd(a + i))); \
+    for (; i < n; i++) a[i] = scalar(a[i]); \
+}
+
+AVX2_UNARY(SqrtAVX2, _mm256_sqrt_pd, sqrt)
+AVX2_UNARY(AbsBlockAVX2, AbsAVX2, fabs)
+AVX2_UNARY(FastExpAVX2, ExpAVX2, FastExp)
+AVX2_UNARY(FastLogAVX2, LogAVX2, FastLog)
+
+#define AVX2_TRIG(name, q0, scalar) \
+TARGET_AVX2 static void name(double* a, size_t n) \
+{ \
+    size_t i = 0; \
+    for (; i + 4 <= n; i += 4) { \
+        __m256d x = _mm256_loadu_pd(a + i); \
+        __m256d in = _mm256_cmp_pd(AbsAVX2(x), _mm256_set1_pd(FM_TRIG_MAX), _CMP_LE_OQ); \
+        _mm256_storeu_pd(a + i, SinCosAVX2(x, q0)); \
+        if (_mm256_movemask_pd(in) != 0xf) { \
+            double v[4]; \
+            _mm256_storeu_pd(v, x); \
+            for (int j = 0; j < 4; j++) a[i + j] = scalar(v[j]); \
+        } \
+    } \
+    for (; i < n; i++) a[i] = scalar(a[i]); \
+}
+
+AVX2_TRIG(FastSinAVX2, 0, FastSin)
+AVX2_TRIG(FastCosAVX2, 1, FastCos)
+
+static bool CpuHasAVX2()
+{
+#if defined(__GNUC__)
+    return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return false;
+#endif
+}
+#endif //COLUMN_KERNELS_X86
+
+//exp, log, sin and cos of the C library have no SIMD form, every level calls them per element
+static const CColumnKernels scalarKernels = {
+    SIMD_LEVEL::Scalar, "scalar", FillScalar, AddScalar, SubScalar, MulScalar, DivScalar, MinScalar, MaxScalar,
+    SqrtScalar, AbsScalar, ExpScalar, LogScalar, SinScalar, CosScalar,
+    FastExpScalar, FastLogScalar, FastSinScalar, FastCosScalar
+};
+#ifdef COLUMN_KERNELS_X86
+static const CColumnKernels sse2Kernels = {
+    SIMD_LEVEL::SSE2, "sse2", FillSSE2, AddSSE2, SubSSE2, MulSSE2, DivSSE2, MinSSE2, MaxSSE2,
+    SqrtSSE2, AbsBlockSSE2, ExpScalar, LogScalar, SinScalar, CosScalar,
+    FastExpSSE2, FastLogSSE2, FastSinSSE2, FastCosSSE2
+};
+static const CColumnKernels avx2Kernels = {
+    SIMD_LEVEL::AVX2, "avx2", FillAVX2, AddAVX2, SubAVX2, MulAVX2, DivAVX2, MinAVX2, MaxAVX2,
+    SqrtAVX2, AbsBlockAVX2, ExpScalar, LogScalar, SinScalar, CosScalar,
+    FastExpAVX2, FastLogAVX2, FastSinAVX2, FastCosAVX2
+};
+#endif //COLUMN_KERNELS_X86
+
+const CColumnKernels& CColumnKernels::Get(SIMD_LEVEL level)
+{
+#ifdef COLUMN_KERNELS_X86
+    //SSE2 is always present on the platforms we build for
+    static const bool avx2 = CpuHasAVX2();
+    if (level == SIMD_LEVEL::AVX2 && avx2) {
+        return avx2Kernels;
+    }
+    if (level >= SIMD_LEVEL::SSE2) {
+        return sse2Kernels;
+    }
+#endif //COLUMN_KERNELS_X86
+    return scalarKernels;
+}
+
+const CColumnKernels& CColumnKernels::Get()
+{
+    static const CColumnKernels& best = Get(SIMD_LEVEL::AVX2);
+    return best;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <stddef.h>
+
+enum class SIMD_LEVEL {
+	Scalar,
+	SSE2,
+	AVX2
+};
+
+//Block kernels used by CCompiledExpression::EvaluateColumns().
+//Binary kernels compute a[i] = a[i] op b[i], unary kernels a[i] = f(a[i]) for i < n.
+//
+//sqrt, abs, min and max give the same bits at every level as the scalar code of
+//CCompiledExpression::Execute(). min and max return NaN if either argument is NaN.
+//exp, log, sin and cos call the C library for every element, except the Fast ones.
+//
+//Fast kernels (--fast-math) are polynomials over whole blocks. The scalar FastExp() etc.
+//below do the same operations in the same order, so every level and the row evaluators
+//give the same bits. Largest error against the C library on 5*10^6 random arguments:
+//  FastExp  1 ulp for -708 <= x <= 709.78, 0 below -708 (no subnormal results)
+//  FastLog  2 ulp
+//  FastSin, FastCos  2 ulp, or 2.3e-16 absolute next to their zeros, for |x| <= 1e5;
+//           larger arguments, infinities and NaN go to the C library
+class CColumnKernels
+{
+public:
+	typedef void (*FillKernel)(double* a, double val, size_t n);
+	typedef void (*BinaryKernel)(double* a, const double* b, size_t n);
+	typedef void (*UnaryKernel)(double* a, size_t n);
+
+	SIMD_LEVEL level;
+	const char* name;
+	FillKernel Fill;
+	BinaryKernel Add;
+	BinaryKernel Sub;
+	BinaryKernel Mul;
+	BinaryKernel Div;
+	BinaryKernel Min;
+	BinaryKernel Max;
+	UnaryKernel Sqrt;
+	UnaryKernel Abs;
+	UnaryKernel Exp;
+	UnaryKernel Log;
+	UnaryKernel Sin;
+	UnaryKernel Cos;
+	UnaryKernel FastExp;
+	UnaryKernel FastLog;
+	UnaryKernel FastSin;
+	UnaryKernel FastCos;
+
+	//best kernels supported by the running CPU
+	static const CColumnKernels& Get();
+	//requested kernels, or the best supported ones below that level
+	static const CColumnKernels& Get(SIMD_LEVEL level);
+};
+
+//scalar forms of the fast kernels
+double FastExp(double x);
+double FastLog(double x);
+double FastSin(double x);
+double FastCos(double x);
+//min and max of two values, NaN if either is NaN
+inline double MinOf(double a, double b) { return a != a ? a : (a < b ? a : b); }
+inline double MaxOf(double a, double b) { return a != a ? a : (a > b ? a : b); }
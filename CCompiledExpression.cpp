@@ -0,0 +1,261 @@
+#include <cmath>
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+
+#include "CCompiledExpression.h"
+#include "CColumnKernels.h"
+#include "CScratchArena.h"
+#include "CLogger.h"
+
+void CCompiledExpression::Clear()
+{
+    m_code.clear();
+    m_consts.clear();
+    m_vars.clear();
+    m_depth = 0;
+    m_top = 0;
+    m_fast = false;
+}
+
+void CCompiledExpression::Push(unsigned int n)
+{
+    m_top += n;
+    if (m_top > m_depth) {
+        m_depth = m_top;
+    }
+}
+
+void CCompiledExpression::EmitConst(double val)
+{
+    m_code.push_back({ OPCODE::Push, (uint32_t)m_consts.size() });
+    m_consts.push_back(val);
+    Push(1);
+}
+
+void CCompiledExpression::EmitVariable(string_view name)
+{
+    int idx = VariableIndex(name);
+    if (idx < 0) {
+        idx = (int)m_vars.size();
+        m_vars.emplace_back(name);
+    }
+    EmitVariable((uint32_t)idx);
+}
+
+void CCompiledExpression::EmitVariable(uint32_t idx)
+{
+    m_code.push_back({ OPCODE::Var, idx });
+    Push(1);
+}
+
+int CCompiledExpression::VariableIndex(string_view name) const
+{
+    for (size_t i = 0; i < m_vars.size(); i++) {
+        if (m_vars[i] == name) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+void CCompiledExpression::EmitOperation(OPCODE op)
+{
+    m_code.push_back({ op, 0 });
+    if (op == OPCODE::Dup) {
+        Push(1);
+    }
+    else if (op >= OPCODE::Add) {
+        //binary operation
+        m_top--;
+    }
+}
+
+void CCompiledExpression::Disassemble(string& out) const
+{
+    static const char* names[] = { "push", "var", "dup", "sqrt", "abs", "exp", "log", "sin", "cos",
+        "add", "sub", "mul", "div", "pow", "min", "max" };
+    char buf[64];
+    for (const SInstruction& in : m_code) {
+        if (&in != &m_code.front()) {
+            out += ' ';
+        }
+        out += names[(int)in.op];
+        if (in.op == OPCODE::Push) {
+            snprintf(buf, sizeof(buf), " %.17g;", m_consts[in.arg]);
+            out += buf;
+        }
+        else if (in.op == OPCODE::Var) {
+            out += ' ';
+            out += m_vars[in.arg];
+            out += ';';
+        }
+        else {
+            out += ';';
+        }
+    }
+}
+
+double CCompiledExpression::Evaluate(const double* vars) const
+{
+    double stack[COMPILED_STACK_SIZE];
+    if (m_depth > COMPILED_STACK_SIZE) {
+        CScratchArena::CScope scratch;
+        return Execute(scratch.Arena().Alloc<double>(m_depth), vars);
+    }
+    return Execute(stack, vars);
+}
+
+double CCompiledExpression::Execute(double* stack, const double* vars) const
+{
+    //the program was validated by Compile(), so the stack can't underflow
+    //and StackDepth() slots are always enough
+    const double* consts = m_consts.data();
+    const bool fast = m_fast;
+    double* sp = stack - 1;
+    for (const SInstruction& in : m_code) {
+        switch (in.op) {
+        case OPCODE::Push:
+            *++sp = consts[in.arg];
+            break;
+        case OPCODE::Var:
+            *++sp = vars[in.arg];
+            break;
+        case OPCODE::Dup:
+            sp[1] = sp[0];
+            sp++;
+            break;
+        case OPCODE::Sqrt:
+            sp[0] = sqrt(sp[0]);
+            break;
+        case OPCODE::Abs:
+            sp[0] = fabs(sp[0]);
+            break;
+        case OPCODE::Exp:
+            sp[0] = fast ? FastExp(sp[0]) : exp(sp[0]);
+            break;
+        case OPCODE::Log:
+            sp[0] = fast ? FastLog(sp[0]) : log(sp[0]);
+            break;
+        case OPCODE::Sin:
+            sp[0] = fast ? FastSin(sp[0]) : sin(sp[0]);
+            break;
+        case OPCODE::Cos:
+            sp[0] = fast ? FastCos(sp[0]) : cos(sp[0]);
+            break;
+        case OPCODE::Add:
+            sp[-1] = sp[-1] + sp[0];
+            sp--;
+            break;
+        case OPCODE::Sub:
+            sp[-1] = sp[-1] - sp[0];
+            sp--;
+            break;
+        case OPCODE::Mul:
+            sp[-1] = sp[-1] * sp[0];
+            sp--;
+            break;
+        case OPCODE::Div:
+            sp[-1] = sp[-1] / sp[0];
+            sp--;
+            break;
+        case OPCODE::Pow:
+            sp[-1] = pow(sp[-1], sp[0]);
+            sp--;
+            break;
+        case OPCODE::Min:
+            sp[-1] = MinOf(sp[-1], sp[0]);
+            sp--;
+            break;
+        case OPCODE::Max:
+            sp[-1] = MaxOf(sp[-1], sp[0]);
+            sp--;
+            break;
+        }
+    }
+    LOGD("result = %f\n", *sp);
+    return *sp;
+}
+
+void CCompiledExpression::EvaluateColumns(const double* const* columns, size_t rows, double* out) const
+{
+    //the same program as Execute(), but every stack slot holds a block of rows,
+    //so the opcode dispatch is paid once per block instead of once per row
+    const CColumnKernels& k = CColumnKernels::Get();
+    const double* consts = m_consts.data();
+    CColumnKernels::UnaryKernel exps = m_fast ? k.FastExp : k.Exp;
+    CColumnKernels::UnaryKernel logs = m_fast ? k.FastLog : k.Log;
+    CColumnKernels::UnaryKernel sins = m_fast ? k.FastSin : k.Sin;
+    CColumnKernels::UnaryKernel coss = m_fast ? k.FastCos : k.Cos;
+    CScratchArena::CScope scratch;
+    double* stack = scratch.Arena().Alloc<double>((size_t)m_depth * COLUMN_BLOCK_SIZE);
+    for (size_t row = 0; row < rows; row += COLUMN_BLOCK_SIZE) {
+        size_t n = min((size_t)COLUMN_BLOCK_SIZE, rows - row);
+        double* sp = stack - COLUMN_BLOCK_SIZE;
+        for (const SInstruction& in : m_code) {
+            switch (in.op) {
+            case OPCODE::Push:
+                sp += COLUMN_BLOCK_SIZE;
+                k.Fill(sp, consts[in.arg], n);
+                break;
+            case OPCODE::Var:
+                sp += COLUMN_BLOCK_SIZE;
+                memcpy(sp, columns[in.arg] + row, n * sizeof(double));
+                break;
+            case OPCODE::Dup:
+                memcpy(sp + COLUMN_BLOCK_SIZE, sp, n * sizeof(double));
+                sp += COLUMN_BLOCK_SIZE;
+                break;
+            case OPCODE::Sqrt:
+                k.Sqrt(sp, n);
+                break;
+            case OPCODE::Abs:
+                k.Abs(sp, n);
+                break;
+            case OPCODE::Exp:
+                exps(sp, n);
+                break;
+            case OPCODE::Log:
+                logs(sp, n);
+                break;
+            case OPCODE::Sin:
+                sins(sp, n);
+                break;
+            case OPCODE::Cos:
+                coss(sp, n);
+                break;
+            case OPCODE::Add:
+                sp -= COLUMN_BLOCK_SIZE;
+                k.Add(sp, sp + COLUMN_BLOCK_SIZE, n);
+                break;
+            case OPCODE::Sub:
+                sp -= COLUMN_BLOCK_SIZE;
+                k.Sub(sp, sp + COLUMN_BLOCK_SIZE, n);
+                break;
+            case OPCODE::Mul:
+                sp -= COLUMN_BLOCK_SIZE;
+                k.Mul(sp, sp + COLUMN_BLOCK_SIZE, n);
+                break;
+            case OPCODE::Div:
+                sp -= COLUMN_BLOCK_SIZE;
+                k.Div(sp, sp + COLUMN_BLOCK_SIZE, n);
+                break;
+            case OPCODE::Pow:
+                sp -= COLUMN_BLOCK_SIZE;
+                for (size_t i = 0; i < n; i++) {
+                    sp[i] = pow(sp[i], sp[i + COLUMN_BLOCK_SIZE]);
+                }
+                break;
+            case OPCODE::Min:
+                sp -= COLUMN_BLOCK_SIZE;
+                k.Min(sp, sp + COLUMN_BLOCK_SIZE, n);
+                break;
+            case OPCODE::Max:
+                sp -= COLUMN_BLOCK_SIZE;
+                k.Max(sp, sp + COLUMN_BLOCK_SIZE, n);
+                break;
+            }
+        }
+        memcpy(out + row, sp, n * sizeof(double));
+    }
+}
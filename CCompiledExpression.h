@@ -0,0 +1,87 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+//expressions deeper than this are evaluated on a heap stack
+#define COMPILED_STACK_SIZE 64
+//rows evaluated together by EvaluateColumns()
+#define COLUMN_BLOCK_SIZE 256
+
+//unary functions replace the top of the stack,
+//binary operations go last, CThreadedProgram relies on the order
+enum class OPCODE : uint8_t {
+	Push, //push m_consts[arg]
+	Var,  //push variable number arg
+	Dup,  //push a copy of the top of the stack
+	Sqrt,
+	Abs,
+	Exp,
+	Log,
+	Sin,
+	Cos,
+	Add,
+	Sub,
+	Mul,
+	Div,
+	Pow,
+	Min,
+	Max
+};
+
+struct SInstruction {
+	OPCODE op;
+	uint32_t arg;
+};
+
+//Flat RPN program produced once by CCalculator::Compile()
+//and evaluated any number of times.
+//It is immutable after compilation, so one object can be shared between threads.
+class CCompiledExpression
+{
+	friend class CCalculator;
+	friend class CExprTree;
+	friend class CThreadedProgram;
+private:
+	//members
+	vector<SInstruction> m_code;
+	vector<double> m_consts;
+	vector<string> m_vars;
+	unsigned int m_depth = 0; //maximum evaluation stack depth
+	unsigned int m_top = 0;   //stack depth at the end of the program emitted so far
+	bool m_fast = false;      //exp, log, sin and cos use the fast kernels, see CColumnKernels.h
+	//methods
+	void Clear();
+	void Push(unsigned int n);
+	void EmitConst(double val);
+	void EmitVariable(string_view name);
+	void EmitVariable(uint32_t idx);
+	void EmitOperation(OPCODE op);
+	double Execute(double* stack, const double* vars) const;
+public:
+	CCompiledExpression() {}
+	CCompiledExpression(const CCompiledExpression&) = default;
+	CCompiledExpression(CCompiledExpression&&) = default;
+	CCompiledExpression& operator=(const CCompiledExpression&) = default;
+	//moves keep the buffers, swap() of two programs does not allocate
+	CCompiledExpression& operator=(CCompiledExpression&&) = default;
+	~CCompiledExpression() {}
+	bool Empty() const { return m_code.empty(); }
+	size_t Size() const { return m_code.size(); }
+	unsigned int StackDepth() const { return m_depth; }
+	bool FastMath() const { return m_fast; }
+	//variable names in order of first appearance in the expression
+	const vector<string>& Variables() const { return m_vars; }
+	int VariableIndex(string_view name) const;
+	//human readable listing of the program
+	void Disassemble(string& out) const;
+	//evaluates the program for one row, vars[i] is the value of Variables()[i]
+	double Evaluate(const double* vars = nullptr) const;
+	//evaluates the program for rows values of every variable,
+	//columns[i] points to the values of Variables()[i].
+	//Rows are processed in blocks of COLUMN_BLOCK_SIZE with SIMD kernels.
+	void EvaluateColumns(const double* const* columns, size_t rows, double* out) const;
+};
@@ -0,0 +1,278 @@
+#include <cmath>
+#include <stdio.h>
+
+#include "CExprTree.h"
+#include "CColumnKernels.h"
+#include "CLogger.h"
+
+//exponents lowered to multiplication chains
+#define POWI_MAX 16
+
+void CExprTree::Build(const CCompiledExpression& prog)
+{
+    m_nodes.clear();
+    m_stack.clear();
+    m_vars = prog.m_vars;
+    for (const SInstruction& in : prog.m_code) {
+        SNode n = { NODE::Const, 0, 0, -1, -1 };
+        switch (in.op) {
+        case OPCODE::Push:
+            n.val = prog.m_consts[in.arg];
+            break;
+        case OPCODE::Var:
+            n.kind = NODE::Var;
+            n.arg = in.arg;
+            break;
+        case OPCODE::Dup:
+            //never produced by the parser
+            n = m_nodes[m_stack.back()];
+            break;
+        case OPCODE::Sqrt:
+        case OPCODE::Abs:
+        case OPCODE::Exp:
+        case OPCODE::Log:
+        case OPCODE::Sin:
+        case OPCODE::Cos:
+            n.kind = (NODE)((int)NODE::Sqrt + (int)in.op - (int)OPCODE::Sqrt);
+            n.left = m_stack.back();
+            m_stack.pop_back();
+            break;
+        default:
+            n.kind = in.op == OPCODE::Add ? NODE::Add
+                : in.op == OPCODE::Sub ? NODE::Sub
+                : in.op == OPCODE::Mul ? NODE::Mul
+                : in.op == OPCODE::Div ? NODE::Div
+                : in.op == OPCODE::Min ? NODE::Min
+                : in.op == OPCODE::Max ? NODE::Max
+                : NODE::Pow;
+            n.right = m_stack.back();
+            m_stack.pop_back();
+            n.left = m_stack.back();
+            m_stack.pop_back();
+            break;
+        }
+        m_stack.push_back((int)m_nodes.size());
+        m_nodes.push_back(n);
+    }
+}
+
+bool CExprTree::IsConst(int idx, double val) const
+{
+    //0 and -0 are different constants here
+    return m_nodes[idx].kind == NODE::Const && m_nodes[idx].val == val
+        && signbit(m_nodes[idx].val) == signbit(val);
+}
+
+double CExprTree::Apply(NODE kind, double a, double b, bool fast)
+{
+    //same arithmetic as CCompiledExpression::Execute()
+    switch (kind) {
+    case NODE::Add: return a + b;
+    case NODE::Sub: return a - b;
+    case NODE::Mul: return a * b;
+    case NODE::Div: return a / b;
+    case NODE::Min: return MinOf(a, b);
+    case NODE::Max: return MaxOf(a, b);
+    case NODE::Sqrt: return sqrt(a);
+    case NODE::Abs: return fabs(a);
+    case NODE::Exp: return fast ? FastExp(a) : exp(a);
+    case NODE::Log: return fast ? FastLog(a) : log(a);
+    case NODE::Sin: return fast ? FastSin(a) : sin(a);
+    case NODE::Cos: return fast ? FastCos(a) : cos(a);
+    default: return pow(a, b);
+    }
+}
+
+void CExprTree::Optimize(unsigned int flags)
+{
+    //children precede their parents, so a single forward pass
+    //sees every subtree already optimized, and deep trees need no recursion
+    for (SNode& n : m_nodes) {
+        if (n.left >= 0) {
+            OptimizeNode(n, flags);
+        }
+    }
+}
+
+void CExprTree::OptimizeNode(SNode& n, unsigned int flags)
+{
+    const SNode& l = m_nodes[n.left];
+    if (n.right < 0) {
+        //function of one argument
+        if ((flags & OPT_FOLD) && l.kind == NODE::Const) {
+            n.val = Apply(n.kind, l.val, 0, (flags & OPT_FAST_MATH) != 0);
+            n.kind = NODE::Const;
+            n.left = -1;
+        }
+        return;
+    }
+    const SNode& r = m_nodes[n.right];
+    if (flags & OPT_FOLD) {
+        if (l.kind == NODE::Const && r.kind == NODE::Const) {
+            n.val = Apply(n.kind, l.val, r.val, (flags & OPT_FAST_MATH) != 0);
+            n.kind = NODE::Const;
+            n.left = n.right = -1;
+            return;
+        }
+        //identities, the node becomes a copy of the remaining operand;
+        //x - 0 and x + -0 keep the sign of a zero x, x + 0 turns -0 into 0
+        bool fast = (flags & OPT_FAST_MATH) != 0;
+        if ((n.kind == NODE::Add && (IsConst(n.right, -0.0) || (fast && IsConst(n.right, 0))))
+            || (n.kind == NODE::Sub && (IsConst(n.right, 0) || (fast && IsConst(n.right, -0.0))))
+            || (n.kind == NODE::Mul && IsConst(n.right, 1))
+            || (n.kind == NODE::Div && IsConst(n.right, 1))
+            || (n.kind == NODE::Pow && IsConst(n.right, 1))) {
+            n = l;
+            return;
+        }
+        if ((n.kind == NODE::Add && (IsConst(n.left, -0.0) || (fast && IsConst(n.left, 0))))
+            || (n.kind == NODE::Mul && IsConst(n.left, 1))) {
+            n = r;
+            return;
+        }
+        if (n.kind == NODE::Pow && (IsConst(n.right, 0) || IsConst(n.right, -0.0))) {
+            //pow(x, 0) is 1 for any x, NaN included
+            n = { NODE::Const, 0, 1, -1, -1 };
+            return;
+        }
+    }
+    if (r.kind != NODE::Const) {
+        return;
+    }
+    //a chain rounds after every multiplication, only the square is rounded once
+    if (n.kind == NODE::Pow && r.val >= 2 && r.val <= POWI_MAX && r.val == floor(r.val)
+        && (flags & (r.val == 2 ? OPT_STRENGTH | OPT_POWI : OPT_POWI))) {
+        n.kind = NODE::PowI;
+        n.arg = (uint32_t)r.val;
+        return;
+    }
+    if (n.kind == NODE::Div && r.val != 0 && isfinite(r.val)) {
+        //1/c is exact when c is a power of two and 1/c is still a normal number
+        int e;
+        double inv = 1 / r.val;
+        bool exact = fabs(frexp(r.val, &e)) == 0.5 && isnormal(inv);
+        if ((exact && (flags & OPT_STRENGTH)) || (flags & OPT_RECIPROCAL)) {
+            SNode& c = m_nodes[n.right];
+            c.val = inv;
+            n.kind = NODE::Mul;
+        }
+    }
+}
+
+void CExprTree::EmitPowI(CCompiledExpression& prog, uint32_t n)
+{
+    //x^n by squaring: x^2k = (x^k)^2, x^(k+1) = x * x^k
+    if (n == 1) {
+        return;
+    }
+    if (n % 2 == 0) {
+        EmitPowI(prog, n / 2);
+        prog.EmitOperation(OPCODE::Dup);
+        prog.EmitOperation(OPCODE::Mul);
+    }
+    else {
+        prog.EmitOperation(OPCODE::Dup);
+        EmitPowI(prog, n - 1);
+        prog.EmitOperation(OPCODE::Mul);
+    }
+}
+
+void CExprTree::Lower(CCompiledExpression& prog)
+{
+    prog.Clear();
+    prog.m_vars = m_vars;
+    if (m_nodes.empty()) {
+        return;
+    }
+    //iterative post-order walk from the root, the last node;
+    //a negative stack entry means the children of the node were emitted already
+    m_stack.clear();
+    m_stack.push_back((int)m_nodes.size() - 1);
+    while (m_stack.size()) {
+        int idx = m_stack.back();
+        m_stack.pop_back();
+        if (idx < 0) {
+            const SNode& n = m_nodes[~idx];
+            switch (n.kind) {
+            case NODE::Add: prog.EmitOperation(OPCODE::Add); break;
+            case NODE::Sub: prog.EmitOperation(OPCODE::Sub); break;
+            case NODE::Mul: prog.EmitOperation(OPCODE::Mul); break;
+            case NODE::Div: prog.EmitOperation(OPCODE::Div); break;
+            case NODE::Pow: prog.EmitOperation(OPCODE::Pow); break;
+            case NODE::PowI: EmitPowI(prog, n.arg); break;
+            case NODE::Min: prog.EmitOperation(OPCODE::Min); break;
+            case NODE::Max: prog.EmitOperation(OPCODE::Max); break;
+            case NODE::Sqrt:
+            case NODE::Abs:
+            case NODE::Exp:
+            case NODE::Log:
+            case NODE::Sin:
+            case NODE::Cos:
+                prog.EmitOperation((OPCODE)((int)OPCODE::Sqrt + (int)n.kind - (int)NODE::Sqrt));
+                break;
+            default: break;
+            }
+            continue;
+        }
+        const SNode& n = m_nodes[idx];
+        if (n.kind == NODE::Const) {
+            prog.EmitConst(n.val);
+        }
+        else if (n.kind == NODE::Var) {
+            prog.EmitVariable(n.arg);
+        }
+        else {
+            m_stack.push_back(~idx);
+            if (n.right >= 0 && n.kind != NODE::PowI) {
+                m_stack.push_back(n.right);
+            }
+            m_stack.push_back(n.left);
+        }
+    }
+    LOGD("optimized program size=%d stack depth=%d\n", (int)prog.Size(), prog.m_depth);
+}
+
+void CExprTree::Dump(string& out) const
+{
+    //text of every node, built bottom-up in node order
+    vector<string> text(m_nodes.size());
+    char buf[64];
+    for (size_t i = 0; i < m_nodes.size(); i++) {
+        const SNode& n = m_nodes[i];
+        switch (n.kind) {
+        case NODE::Const:
+            snprintf(buf, sizeof(buf), "%.17g", n.val);
+            text[i] = buf;
+            break;
+        case NODE::Var:
+            text[i] = m_vars[n.arg];
+            break;
+        case NODE::PowI:
+            snprintf(buf, sizeof(buf), " ^ %u)", n.arg);
+            text[i] = "(" + text[n.left] + buf;
+            break;
+        case NODE::Min:
+        case NODE::Max:
+            text[i] = (n.kind == NODE::Min ? "min(" : "max(") + text[n.left] + ", " + text[n.right] + ")";
+            break;
+        case NODE::Sqrt:
+        case NODE::Abs:
+        case NODE::Exp:
+        case NODE::Log:
+        case NODE::Sin:
+        case NODE::Cos: {
+            static const char* names[] = { "sqrt(", "abs(", "exp(", "log(", "sin(", "cos(" };
+            text[i] = names[(int)n.kind - (int)NODE::Sqrt] + text[n.left] + ")";
+            break;
+        }
+        default: {
+            static const char* ops[] = { "", "", " + ", " - ", " * ", " / ", " ^ " };
+            text[i] = "(" + text[n.left] + ops[(int)n.kind] + text[n.right] + ")";
+            break;
+        }
+        }
+    }
+    if (text.size()) {
+        out += text.back();
+    }
+}
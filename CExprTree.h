@@ -0,0 +1,70 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "CCompiledExpression.h"
+
+using namespace std;
+
+//optimization flags
+#define OPT_NONE       0x00
+#define OPT_FOLD       0x01 //fold constant subtrees, remove -0, + -0, *1, /1, ^1
+#define OPT_STRENGTH   0x02 //x^2 to x*x (correctly rounded, pow() may be 1 ulp off), exact reciprocals
+#define OPT_RECIPROCAL 0x04 //any division by a constant to a multiplication, may change the last bit
+#define OPT_FAST_MATH  0x08 //polynomial exp, log, sin and cos, error bounds in CColumnKernels.h; remove +0
+#define OPT_POWI       0x10 //x^3 .. x^16 to multiplication chains, may change the last bits
+#define OPT_DEFAULT    (OPT_FOLD | OPT_STRENGTH)
+
+//Expression tree built from a compiled program, optimized
+//and lowered back into an equivalent, shorter program.
+class CExprTree
+{
+	enum class NODE : uint8_t {
+		Const,
+		Var,
+		Add,
+		Sub,
+		Mul,
+		Div,
+		Pow,
+		PowI, //integer power, lowered to a multiplication chain
+		Min,
+		Max,
+		Sqrt, //functions of one argument, right is -1
+		Abs,
+		Exp,
+		Log,
+		Sin,
+		Cos
+	};
+
+	struct SNode {
+		NODE kind;
+		uint32_t arg; //variable index or PowI exponent
+		double val;   //constant value
+		int left;
+		int right;
+	};
+
+private:
+	//members
+	//nodes are kept in postfix order, children always precede their parent
+	vector<SNode> m_nodes;
+	vector<string> m_vars;
+	vector<int> m_stack;
+	//methods
+	//constant of this value, 0 and -0 differ
+	bool IsConst(int idx, double val) const;
+	static double Apply(NODE kind, double a, double b, bool fast);
+	void OptimizeNode(SNode& n, unsigned int flags);
+	void EmitPowI(CCompiledExpression& prog, uint32_t n);
+public:
+	CExprTree() {}
+	~CExprTree() {}
+	void Build(const CCompiledExpression& prog);
+	void Optimize(unsigned int flags);
+	void Lower(CCompiledExpression& prog);
+	//fully parenthesized infix form
+	void Dump(string& out) const;
+};
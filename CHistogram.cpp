@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include "CHistogram.h"
+
+unsigned int CHistogram::Bucket(uint64_t value)
+{
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return (unsigned int)value;
+    }
+    //position of the highest bit, then the HISTOGRAM_SUB_BITS bits below it
+#ifdef __GNUC__
+    unsigned int msb = 63 - __builtin_clzll(value);
+#else
+    unsigned int msb = 63;
+    while (!(value >> msb)) {
+        msb--;
+    }
+#endif
+    unsigned int sub = (unsigned int)(value >> (msb - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return (msb - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+uint64_t CHistogram::BucketLimit(unsigned int bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    unsigned int msb = bucket / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BITS - 1;
+    uint64_t sub = bucket % HISTOGRAM_SUB_BUCKETS;
+    if (msb >= 63 && sub == HISTOGRAM_SUB_BUCKETS - 1) {
+        return UINT64_MAX;
+    }
+    //largest value with this msb and these sub bucket bits
+    return ((HISTOGRAM_SUB_BUCKETS + sub + 1) << (msb - HISTOGRAM_SUB_BITS)) - 1;
+}
+
+void CHistogram::Record(uint64_t value)
+{
+    //the count is the sum of the buckets, the max is rarely written
+    m_buckets[Bucket(value)].fetch_add(1, memory_order_relaxed);
+    m_sum.fetch_add(value, memory_order_relaxed);
+    uint64_t max = m_max.load(memory_order_relaxed);
+    while (value > max && !m_max.compare_exchange_weak(max, value, memory_order_relaxed)) {
+    }
+}
+
+void CHistogram::Reset()
+{
+    for (auto& b : m_buckets) {
+        b.store(0, memory_order_relaxed);
+    }
+    m_sum.store(0, memory_order_relaxed);
+    m_max.store(0, memory_order_relaxed);
+}
+
+void CHistogram::Add(const CHistogram& other)
+{
+    for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        uint64_t n = other.m_buckets[i].load(memory_order_relaxed);
+        if (n) {
+            m_buckets[i].fetch_add(n, memory_order_relaxed);
+        }
+    }
+    m_sum.fetch_add(other.Sum(), memory_order_relaxed);
+    uint64_t value = other.Max();
+    uint64_t max = m_max.load(memory_order_relaxed);
+    while (value > max && !m_max.compare_exchange_weak(max, value, memory_order_relaxed)) {
+    }
+}
+
+uint64_t CHistogram::Count() const
+{
+    uint64_t total = 0;
+    for (auto& b : m_buckets) {
+        total += b.load(memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t CHistogram::Percentile(double p) const
+{
+    uint64_t total = Count();
+    if (!total) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(p * (double)total);
+    if (rank >= total) {
+        rank = total - 1;
+    }
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += m_buckets[i].load(memory_order_relaxed);
+        if (seen > rank) {
+            uint64_t limit = BucketLimit(i);
+            uint64_t max = Max();
+            return limit < max ? limit : max;
+        }
+    }
+    return Max();
+}
+
+void CHistogram::Write(string& out, const string& name, const string& labels) const
+{
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    string sep = labels.size() ? labels + "," : labels;
+    char line[256];
+    for (double q : quantiles) {
+        snprintf(line, sizeof(line), "%s{%squantile=\"%g\"} %llu\n", name.c_str(), sep.c_str(), q,
+            (unsigned long long)Percentile(q));
+        out += line;
+    }
+    string braces = labels.size() ? "{" + labels + "}" : "";
+    snprintf(line, sizeof(line), "%s_count%s %llu\n%s_sum%s %llu\n%s_max%s %llu\n",
+        name.c_str(), braces.c_str(), (unsigned long long)Count(),
+        name.c_str(), braces.c_str(), (unsigned long long)Sum(),
+        name.c_str(), braces.c_str(), (unsigned long long)Max());
+    out += line;
+}
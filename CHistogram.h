@@ -0,0 +1,44 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+using namespace std;
+
+//2^HISTOGRAM_SUB_BITS buckets per power of two, values up to 2^64 - 1:
+//5 bits bound the error of a percentile by 1/32 at 8 bytes * 1920 buckets
+#ifndef HISTOGRAM_SUB_BITS
+#define HISTOGRAM_SUB_BITS 5
+#endif
+#define HISTOGRAM_SUB_BUCKETS (1u << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+//Lock-free log-linear histogram of durations in nanoseconds. Record() is two relaxed
+//atomic adds, percentiles are accurate to 1 / HISTOGRAM_SUB_BUCKETS of their value.
+class CHistogram
+{
+public:
+	CHistogram() {}
+	~CHistogram() {}
+
+	void Record(uint64_t value);
+	void Reset();
+	//adds the values of other, per thread histograms are merged for a report
+	void Add(const CHistogram& other);
+
+	uint64_t Count() const;
+	uint64_t Sum() const { return m_sum.load(memory_order_relaxed); }
+	uint64_t Max() const { return m_max.load(memory_order_relaxed); }
+	//upper bound of the bucket holding the p-th fraction of the values, p in 0..1
+	uint64_t Percentile(double p) const;
+
+	//plain text metrics: <name>{quantile="0.5"} <value>, <name>_count, <name>_sum, <name>_max
+	void Write(string& out, const string& name, const string& labels = "") const;
+
+	static unsigned int Bucket(uint64_t value);
+	static uint64_t BucketLimit(unsigned int bucket);
+private:
+	atomic<uint64_t> m_buckets[HISTOGRAM_BUCKETS] = {};
+	atomic<uint64_t> m_sum{ 0 };
+	atomic<uint64_t> m_max{ 0 };
+};
@@ -0,0 +1,84 @@
+#include "CLineReader.h"
+#include "CLogger.h"
+
+#define LINE_READER_BLOCK_SIZE (256 * 1024)
+//mapped blocks cost nothing to hand out, so they can be larger
+#define LINE_READER_MAPPED_BLOCK_SIZE (1024 * 1024)
+//how far ahead of the current block the kernel is asked to read
+#define LINE_READER_READ_AHEAD (32 * 1024 * 1024)
+
+CLineReader::~CLineReader()
+{
+    if (m_close) {
+        fclose(m_file);
+    }
+}
+
+bool CLineReader::Open(const string& source)
+{
+    if (source == "-") {
+        m_file = stdin;
+        m_close = false;
+    }
+    else if (m_map.Open(source)) {
+        m_mapped = true;
+        return true;
+    }
+    else {
+        m_file = fopen(source.c_str(), "rb");
+        m_close = m_file != nullptr;
+    }
+    return m_file != nullptr;
+}
+
+bool CLineReader::NextMapped(string_view& block)
+{
+    //line boundaries are found in place, nothing is copied
+    string_view data = m_map.View();
+    if (m_pos >= data.size()) {
+        return false;
+    }
+    if (m_prefetched < m_pos + LINE_READER_READ_AHEAD / 2) {
+        m_map.Prefetch(m_prefetched, m_pos + LINE_READER_READ_AHEAD - m_prefetched);
+        m_prefetched = m_pos + LINE_READER_READ_AHEAD;
+    }
+    size_t end = m_pos + LINE_READER_MAPPED_BLOCK_SIZE;
+    if (end >= data.size()) {
+        end = data.size();
+    }
+    else {
+        end = data.find('\n', end);
+        end = end == string_view::npos ? data.size() : end + 1;
+    }
+    block = data.substr(m_pos, end - m_pos);
+    m_pos = end;
+    return true;
+}
+
+bool CLineReader::Next(string& storage, string_view& block)
+{
+    if (m_mapped) {
+        return NextMapped(block);
+    }
+    storage.swap(m_carry);
+    m_carry.clear();
+    while (1) {
+        size_t old = storage.size();
+        storage.resize(old + LINE_READER_BLOCK_SIZE);
+        size_t n = fread(&storage[old], 1, LINE_READER_BLOCK_SIZE, m_file);
+        storage.resize(old + n);
+        if (n == 0) {
+            //end of input, whatever is left is the last line
+            block = storage;
+            return storage.size() > 0;
+        }
+        size_t pos = storage.rfind('\n');
+        if (pos != string::npos) {
+            m_carry.assign(storage, pos + 1, string::npos);
+            storage.resize(pos + 1);
+            block = storage;
+            return true;
+        }
+        //no line end in the new data yet, keep reading
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <stdio.h>
+#include <string>
+#include <string_view>
+
+#include "CMappedFile.h"
+
+using namespace std;
+
+//Reads the batch input in large blocks of whole lines.
+//Regular files are memory mapped and the blocks are views into the mapping,
+//pipes and the standard input are read with fread.
+class CLineReader
+{
+public:
+	CLineReader() {}
+	~CLineReader();
+	//"-" is the standard input
+	bool Open(const string& source);
+	//next block of whole lines, the last line of the input may have no '\n'.
+	//The block is either a view into the mapping, valid while the reader is alive,
+	//or is kept in storage and stays valid while storage is not modified.
+	bool Next(string& storage, string_view& block);
+	bool Mapped() const { return m_mapped; }
+private:
+	FILE* m_file = nullptr;
+	bool m_close = false;
+	string m_carry; //incomplete last line of the previous block
+	CMappedFile m_map;
+	bool m_mapped = false;
+	size_t m_pos = 0;        //start of the next mapped block
+	size_t m_prefetched = 0; //end of the range already handed to Prefetch()
+
+	bool NextMapped(string_view& block);
+};
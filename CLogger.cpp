@@ -1,25 +1,30 @@
-#ifdef _DEBUG
+#include "CLogger.h"
+
+#ifdef CALC_LOGGING
 
 #ifdef _WIN32
 #include <windows.h>
+#include <io.h>
 #else //_WIN32
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
 #include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #endif //_WIN32
 
 #include <cstdarg>
+#include <charconv>
 #include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <ctype.h>
-
-#include "CLogger.h"
-
-bool CheckLevelMask(uint32_t mask)
-{
-    return CLogger::m_level_mask & mask;
-}
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
 
 void LogInitConsole(LOG_FORMATTER formatter)
 {
@@ -37,9 +42,48 @@ void LogInitColorConsole()
     CLogger::GetInstance().SetFormatter(LOG_FORMATTER::COLORTEXT);
 }
 
-void LogInitTextFile(const string& name)
+void LogInitAsync(LOG_OVERFLOW policy)
+{
+    CLogger::GetInstance().SetAsync(true, policy);
+}
+
+void LogInitBinaryFile(const string& name, const SLogFileOptions& options)
+{
+    CLogger::GetInstance().AddWriter(dynamic_cast<CLogWriter*>(new CFileWriter(name, true, options)));
+    CLogger::GetInstance().SetLevelMask(LOG_ALL_LEVELS);
+    CLogger::GetInstance().SetFormatter(LOG_FORMATTER::BINARY);
+}
+
+void LogInitSites(const string& spec)
+{
+    size_t pos = 0;
+    bool first = true;
+    while (pos <= spec.size()) {
+        size_t end = spec.find(',', pos);
+        if (end == string::npos) {
+            end = spec.size();
+        }
+        string pattern = spec.substr(pos, end - pos);
+        pos = end + 1;
+        bool enable = true;
+        if (pattern.size() && (pattern[0] == '-' || pattern[0] == '+')) {
+            enable = pattern[0] == '+';
+            pattern.erase(0, 1);
+        }
+        if (pattern.empty()) {
+            continue;
+        }
+        if (first) {
+            CLogger::GetInstance().ResetSiteFilters(!enable);
+            first = false;
+        }
+        CLogger::GetInstance().SetSiteFilter(pattern, enable);
+    }
+}
+
+void LogInitTextFile(const string& name, const SLogFileOptions& options)
 {
-    CLogger::GetInstance().AddWriter(dynamic_cast<CLogWriter*>(new CFileWriter(name)));
+    CLogger::GetInstance().AddWriter(dynamic_cast<CLogWriter*>(new CFileWriter(name, false, options)));
     CLogger::GetInstance().SetLevelMask(LOG_ALL_LEVELS);
     CLogger::GetInstance().SetFormatMask(LOG_FUNC_MAME | LOG_LINE_NUM | LOG_TIME_STAMP | LOG_PROC_ID | LOG_THREAD_ID | LOG_LOG_NUM);
     CLogger::GetInstance().SetFormatter(LOG_FORMATTER::COLORTEXT);
@@ -47,7 +91,60 @@ void LogInitTextFile(const string& name)
 
 void CLogger::AddWriter(CLogWriter* lw)
 {
-    m_Wr.push_back(shared_ptr<CLogWriter>(lw));
+    uint32_t tick = lw->TickMs();
+    {
+        lock_guard lock(m_Mutex);
+        m_Wr.push_back(shared_ptr<CLogWriter>(lw));
+        //a binary log starts with the header and repeats the call site definitions
+        m_bin_started = false;
+    }
+    if (tick) {
+        {
+            lock_guard lock(m_timer_mutex);
+            if (!m_tick_ms || tick < m_tick_ms) {
+                m_tick_ms = tick;
+            }
+        }
+        m_timer_wake.notify_one();
+        StartTimer();
+    }
+}
+
+//process and thread ids are looked up once, a forked child looks them up again
+static atomic<uint32_t> s_pid{ 0 };
+static thread_local uint32_t t_tid = 0;
+
+static void ResetIds()
+{
+    //only the forking thread exists in the child
+    s_pid.store(0, memory_order_relaxed);
+    t_tid = 0;
+}
+
+static uint32_t ProcessId()
+{
+    uint32_t pid = s_pid.load(memory_order_relaxed);
+    if (!pid) {
+#ifdef _WIN32
+        pid = GetCurrentProcessId();
+#else //_WIN32
+        pid = getpid();
+#endif //_WIN32
+        s_pid.store(pid, memory_order_relaxed);
+    }
+    return pid;
+}
+
+static uint32_t ThreadId()
+{
+    if (!t_tid) {
+#ifdef _WIN32
+        t_tid = GetCurrentThreadId();
+#else //_WIN32
+        t_tid = (uint32_t)syscall(SYS_gettid);
+#endif //_WIN32
+    }
+    return t_tid;
 }
 
 CLogger::CLogger()
@@ -56,7 +153,20 @@ CLogger::CLogger()
     hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
     GetConsoleMode(hStdout, &consoleMode);
     SetConsoleMode(hStdout, consoleMode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+#else //_WIN32
+    pthread_atfork(nullptr, nullptr, ResetIds);
 #endif //_WIN32
+    m_clock_base = chrono::steady_clock::now();
+    m_clock_base_us = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    //the singleton is never destroyed, write the queued and buffered records out at exit
+    atexit([] {
+        CLogger::GetInstance().SetAsync(false);
+        CLogger::GetInstance().StopTimer();
+        lock_guard lock(CLogger::GetInstance().m_Mutex);
+        for (auto const& Wr : CLogger::GetInstance().m_Wr) {
+            Wr->Flush();
+        }
+    });
 }
 CLogger::~CLogger()
 {
@@ -67,234 +177,1038 @@ CLogger::~CLogger()
 
 void CLogger::SetFormatter(LOG_FORMATTER val)
 {
-    if (val > LOG_FORMATTER::EXCEL) {
+    if (val > LOG_FORMATTER::BINARY) {
         return;
     }
+    lock_guard lock(m_Mutex);
     m_formatter = val;
+    m_bin_started = false;
+}
+
+void CLogger::Capture(SLogRecord& rec, int level, const char* file, const char* function, int line)
+{
+    rec.site = nullptr;
+    rec.level = level;
+    rec.file = file;
+    rec.function = function;
+    rec.line = line;
+    //monotonic, wall clock time of the first record plus the steady clock since
+    rec.time_us = m_clock_base_us +
+        chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - m_clock_base).count();
+    rec.pid = ProcessId();
+    rec.tid = ThreadId();
 }
 
 void CLogger::Log(int level, const char* file, const char* function, int line, const char* format, ...)
 {
-    lock_guard lock(m_Mutex);
-    char buffer[LOG_STR_LEN];
-    int len = 0;
     va_list args;
     va_start(args, format);
+    LogV(level, file, function, line, format, args);
+    va_end(args);
+}
+
+void CLogger::LogText(const SLogSite& site, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    LogV(site.level, site.file, site.function, site.line, format, args);
+    va_end(args);
+}
+
+void CLogger::LogV(int level, const char* file, const char* function, int line, const char* format, va_list args)
+{
+    auto t0 = chrono::steady_clock::now();
+    if (EnterAsync()) {
+        Enqueue(level, file, function, line, format, args);
+        LeaveAsync();
+    }
+    else {
+        auto lock = Lock();
+        SLogRecord rec;
+        Capture(rec, level, file, function, line);
+        rec.len = vsnprintf(rec.msg, LOG_STR_LEN, format, args);
+        Count(level, rec.len);
+        WriteRecord(rec);
+    }
+    m_latency.Record(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t0).count());
+}
+
+unique_lock<mutex> CLogger::Lock()
+{
+    //an uncontended lock is not timed
+    unique_lock<mutex> lock(m_Mutex, try_to_lock);
+    if (!lock.owns_lock()) {
+        auto t0 = chrono::steady_clock::now();
+        lock.lock();
+        m_mutex_waits.fetch_add(1, memory_order_relaxed);
+        m_mutex_wait_ns.fetch_add(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t0).count(),
+            memory_order_relaxed);
+    }
+    return lock;
+}
+
+//levels are single bits, LOG_TRACE..LOG_FATAL map to 0..5
+static int LevelIndex(int level)
+{
+    for (int i = 0; i < LOG_LEVELS; i++) {
+        if (level == 1 << i) {
+            return i;
+        }
+    }
+    return LOG_LEVELS;
+}
+
+void CLogger::Count(int level, int len)
+{
+    int i = LevelIndex(level);
+    if (len >= LOG_STR_LEN) {
+        m_truncated.fetch_add(1, memory_order_relaxed);
+        len = LOG_STR_LEN - 1;
+    }
+    m_level_records[i].fetch_add(1, memory_order_relaxed);
+    m_level_bytes[i].fetch_add(len > 0 ? len : 0, memory_order_relaxed);
+}
+
+void CLogger::WriteRecord(const SLogRecord& rec)
+{
+    if (m_formatter == LOG_FORMATTER::BINARY) {
+        EncodeRecord(rec);
+        for (auto const& Wr : m_Wr) {
+            if (!Wr->Binary()) {
+                continue;
+            }
+            if (Wr->Rotate((int)m_bin.size())) {
+                //the new file starts with the header and the call site definitions again
+                m_bin_started = false;
+                EncodeRecord(rec);
+            }
+            Wr->Write(m_bin.data(), (int)m_bin.size(), rec.level);
+            Wr->Count((int)m_bin.size());
+        }
+        return;
+    }
+    char buffer[LOG_STR_LEN];
+    int len;
+    if (rec.site) {
+        //queued in binary mode, the formatter was changed since
+        char msg[LOG_STR_LEN];
+        int msg_len = FormatPacked(msg, rec.site->format, rec.msg, rec.len);
+        len = FormatRecord(buffer, rec, msg, msg_len);
+    }
+    else {
+        len = FormatRecord(buffer, rec, rec.msg, rec.len);
+    }
+    for (auto const& Wr : m_Wr) {
+        Wr->Write(buffer, len, rec.level);
+        Wr->Count(len);
+    }
+}
+
+void CLogger::Replay(const SLogRecord& rec)
+{
+    lock_guard lock(m_Mutex);
+    WriteRecord(rec);
+}
+
+//filled before main(), single threaded, read by the logger afterwards
+static vector<SLogSite*>& LogStaticSites()
+{
+    static vector<SLogSite*> sites;
+    return sites;
+}
+
+bool LogAddStaticSite(SLogSite* site)
+{
+    LogStaticSites().push_back(site);
+    return true;
+}
+
+void CLogger::AddSite(SLogSite& site)
+{
+    if (!site.id.load(memory_order_relaxed)) {
+        site.id.store(++m_site_count, memory_order_relaxed);
+        m_sites.push_back(&site);
+    }
+}
+
+void CLogger::AddStaticSites()
+{
+    vector<SLogSite*>& sites = LogStaticSites();
+    for (; m_static_sites < sites.size(); m_static_sites++) {
+        AddSite(*sites[m_static_sites]);
+    }
+}
+
+void CLogger::RegisterSite(SLogSite& site, const char* format)
+{
+    //a known site stays LOG_SITE_NEW until its first call brings the format
+    lock_guard lock(m_Mutex);
+    if (site.state.load(memory_order_relaxed) != LOG_SITE_NEW) {
+        return;
+    }
+    //find the %.*s strings so the producer copies no more than the precision
+    uint32_t bounded = 0;
+    int index = 0;
+    for (const char* p = format; *p; p++) {
+        if (*p != '%') {
+            continue;
+        }
+        if (*++p == '%') {
+            continue;
+        }
+        while (*p && strchr("-+ #0", *p)) p++;
+        if (*p == '*') {
+            index++;
+            p++;
+        }
+        while (isdigit((unsigned char)*p)) p++;
+        bool star = false;
+        if (*p == '.') {
+            p++;
+            if (*p == '*') {
+                star = true;
+                index++;
+                p++;
+            }
+            while (isdigit((unsigned char)*p)) p++;
+        }
+        while (*p && strchr("hlLqjzt", *p)) p++;
+        if (!*p) {
+            break;
+        }
+        if (*p == 's' && star && index < 32) {
+            bounded |= 1u << index;
+        }
+        index++;
+    }
+    site.format = format;
+    site.bounded = bounded;
+    AddStaticSites();
+    AddSite(site);
+    site.state.store(SiteEnabled(site) ? LOG_SITE_ON : LOG_SITE_OFF, memory_order_release);
+}
+
+//file name without the directories
+static const char* BaseName(const char* path)
+{
+    const char* name = path;
+    for (const char* p = path; *p; p++) {
+        if (*p == '/' || *p == '\\') {
+            name = p + 1;
+        }
+    }
+    return name;
+}
+
+bool CLogger::SiteEnabled(const SLogSite& site)
+{
+    bool enable = m_sites_default;
+    for (auto const& f : m_filters) {
+        const string& p = f.pattern;
+        bool match = p == site.file || p == BaseName(site.file) || p == site.function;
+        if (!match && p.find("::") != string::npos) {
+            //"Class::Method" followed by the parameter list in the signature
+            const char* m = strstr(site.signature, p.c_str());
+            match = m && m[p.size()] == '(';
+        }
+        if (match) {
+            enable = f.enable;
+        }
+    }
+    return enable;
+}
+
+void CLogger::SetSiteFilter(const string& pattern, bool enable)
+{
+    lock_guard lock(m_Mutex);
+    m_filters.push_back({ pattern, enable });
+    for (auto site : m_sites) {
+        //a site that has not run gets its state from the filters on its first call
+        if (site->state.load(memory_order_relaxed) != LOG_SITE_NEW) {
+            site->state.store(SiteEnabled(*site) ? LOG_SITE_ON : LOG_SITE_OFF, memory_order_relaxed);
+        }
+    }
+}
+
+void CLogger::ResetSiteFilters(bool enable)
+{
+    lock_guard lock(m_Mutex);
+    m_filters.clear();
+    m_sites_default = enable;
+    for (auto site : m_sites) {
+        if (site->state.load(memory_order_relaxed) != LOG_SITE_NEW) {
+            site->state.store(enable ? LOG_SITE_ON : LOG_SITE_OFF, memory_order_relaxed);
+        }
+    }
+}
+
+void CLogger::ListSites(string& out)
+{
+    lock_guard lock(m_Mutex);
+    AddStaticSites();
+    char line[LOG_STR_LEN];
+    for (auto site : m_sites) {
+        uint8_t state = site->state.load(memory_order_relaxed);
+        bool on = state == LOG_SITE_NEW ? SiteEnabled(*site) : state == LOG_SITE_ON;
+        snprintf(line, sizeof(line), "%u %s %s:%d %s\n", site->id.load(memory_order_relaxed),
+            on ? "on " : "off",
+            BaseName(site->file), site->line, site->signature);
+        out += line;
+    }
+}
+
+void CLogger::LogPacked(SLogSite& site, const char* args, int len)
+{
+    auto t0 = chrono::steady_clock::now();
+    SLogRecord* rec;
+    SLogRecord local;
+    unique_lock<mutex> lock;
+    bool async = EnterAsync();
+    if (async) {
+        rec = Claim();
+    }
+    else {
+        lock = Lock();
+        rec = &local;
+    }
+    if (rec) {
+        Capture(*rec, site.level, site.file, site.function, site.line);
+        rec->site = &site;
+        rec->len = len;
+        memcpy(rec->msg, args, len);
+        Count(site.level, len);
+        if (async) {
+            Publish(rec);
+        }
+        else {
+            WriteRecord(*rec);
+        }
+    }
+    if (async) {
+        LeaveAsync();
+    }
+    m_latency.Record(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t0).count());
+}
+
+//binary writers, native byte order
+template<typename T>
+static void PutValue(string& out, T v)
+{
+    out.append((const char*)&v, sizeof(v));
+}
+
+static void PutString(string& out, const char* s, size_t len)
+{
+    uint16_t n = (uint16_t)(len < 0xffff ? len : 0xffff);
+    PutValue(out, n);
+    out.append(s, n);
+}
+
+void CLogger::EncodeRecord(const SLogRecord& rec)
+{
+    m_bin.clear();
+    if (!m_bin_started) {
+        m_bin += LOG_BIN_HEADER;
+        m_bin += LOG_BIN_MAGIC;
+        m_bin += (char)LOG_BIN_VERSION;
+        m_site_written.clear();
+        m_bin_started = true;
+    }
+    if (!rec.site) {
+        //text record, from Log() without a call site
+        m_bin += LOG_BIN_MESSAGE;
+        PutValue(m_bin, (int32_t)rec.level);
+        PutValue(m_bin, (int32_t)rec.line);
+        PutValue(m_bin, rec.time_us);
+        PutValue(m_bin, rec.pid);
+        PutValue(m_bin, rec.tid);
+        PutString(m_bin, rec.file, strlen(rec.file));
+        PutString(m_bin, rec.function, strlen(rec.function));
+        PutString(m_bin, rec.msg, rec.len < LOG_STR_LEN ? rec.len : LOG_STR_LEN - 1);
+        return;
+    }
+    uint32_t id = rec.site->id.load(memory_order_relaxed);
+    if (m_site_written.size() <= id) {
+        m_site_written.resize(id + 1);
+    }
+    if (!m_site_written[id]) {
+        //the first record of a call site carries its definition
+        m_bin += LOG_BIN_SITE;
+        PutValue(m_bin, id);
+        PutValue(m_bin, (int32_t)rec.site->level);
+        PutValue(m_bin, (int32_t)rec.site->line);
+        PutString(m_bin, rec.site->file, strlen(rec.site->file));
+        PutString(m_bin, rec.site->function, strlen(rec.site->function));
+        PutString(m_bin, rec.site->format, strlen(rec.site->format));
+        m_site_written[id] = true;
+    }
+    m_bin += LOG_BIN_RECORD;
+    PutValue(m_bin, id);
+    PutValue(m_bin, rec.time_us);
+    PutValue(m_bin, rec.pid);
+    PutValue(m_bin, rec.tid);
+    PutValue(m_bin, (uint16_t)rec.len);
+    m_bin.append(rec.msg, rec.len);
+}
+
+//one unpacked argument
+struct SLogArg {
+    char tag;
+    int64_t i;
+    double d;
+    const char* s;
+    int len;
+};
+
+static bool NextArg(const char*& p, const char* end, SLogArg& arg)
+{
+    if (p >= end) {
+        return false;
+    }
+    arg.tag = *p++;
+    if (arg.tag == LOG_ARG_STRING) {
+        uint16_t n;
+        if (end - p < 2) {
+            return false;
+        }
+        memcpy(&n, p, 2);
+        p += 2;
+        if (end - p < n) {
+            return false;
+        }
+        arg.s = p;
+        arg.len = n;
+        p += n;
+        return true;
+    }
+    if (end - p < 8) {
+        return false;
+    }
+    if (arg.tag == LOG_ARG_DOUBLE) {
+        memcpy(&arg.d, p, 8);
+        arg.i = (int64_t)arg.d;
+    }
+    else {
+        memcpy(&arg.i, p, 8);
+        arg.d = arg.tag == LOG_ARG_UINT ? (double)(uint64_t)arg.i : (double)arg.i;
+    }
+    p += 8;
+    return true;
+}
+
+template<typename T>
+static int PrintSpec(char* out, int size, const char* spec, const int* stars, int nstars, T v)
+{
+    switch (nstars) {
+    case 0: return snprintf(out, size, spec, v);
+    case 1: return snprintf(out, size, spec, stars[0], v);
+    default: return snprintf(out, size, spec, stars[0], stars[1], v);
+    }
+}
+
+int CLogger::FormatPacked(char out[LOG_STR_LEN], const char* format, const char* args, int len)
+{
+    const char* end = args + len;
+    int n = 0;
+    out[0] = 0;
+    for (const char* p = format; *p && n < LOG_STR_LEN - 1;) {
+        if (*p != '%') {
+            out[n++] = *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            out[n++] = '%';
+            p += 2;
+            continue;
+        }
+        //rebuild the conversion with the length modifier of the packed type
+        char spec[32];
+        int sl = 0;
+        int stars[2] = {};
+        int nstars = 0;
+        SLogArg arg{};
+        const char* start = p++;
+        spec[sl++] = '%';
+        while (*p && strchr("-+ #0", *p) && sl < 8) spec[sl++] = *p++;
+        while (*p == '*' || *p == '.' || isdigit((unsigned char)*p)) {
+            if (*p == '*') {
+                if (nstars == 2 || !NextArg(args, end, arg)) {
+                    break;
+                }
+                stars[nstars++] = (int)arg.i;
+            }
+            if (sl < 20) spec[sl++] = *p;
+            p++;
+        }
+        while (*p && strchr("hlLqjzt", *p)) p++;
+        char conv = *p;
+        if (!conv || !strchr("diouxXcfFeEgGaAsp", conv) || !NextArg(args, end, arg)) {
+            //unknown conversion or missing argument, copy it as is
+            int l = (int)(p - start) + (conv ? 1 : 0);
+            for (int i = 0; i < l && n < LOG_STR_LEN - 1; i++) out[n++] = start[i];
+            p += conv ? 1 : 0;
+            continue;
+        }
+        p++;
+        int size = LOG_STR_LEN - n;
+        int w = 0;
+        if (strchr("dioxXu", conv)) {
+            spec[sl++] = 'l';
+            spec[sl++] = 'l';
+            spec[sl++] = conv;
+            spec[sl] = 0;
+            w = PrintSpec(out + n, size, spec, stars, nstars, (long long)arg.i);
+        }
+        else if (conv == 'c') {
+            spec[sl++] = conv;
+            spec[sl] = 0;
+            w = PrintSpec(out + n, size, spec, stars, nstars, (int)arg.i);
+        }
+        else if (conv == 's') {
+            char text[LOG_STR_LEN];
+            int l = arg.tag == LOG_ARG_STRING ? (arg.len < LOG_STR_LEN ? arg.len : LOG_STR_LEN - 1) : 0;
+            memcpy(text, arg.tag == LOG_ARG_STRING ? arg.s : "", l);
+            text[l] = 0;
+            spec[sl++] = conv;
+            spec[sl] = 0;
+            w = PrintSpec(out + n, size, spec, stars, nstars, (const char*)text);
+        }
+        else if (conv == 'p') {
+            spec[sl++] = conv;
+            spec[sl] = 0;
+            w = PrintSpec(out + n, size, spec, stars, nstars, (void*)(uintptr_t)arg.i);
+        }
+        else {
+            spec[sl++] = conv;
+            spec[sl] = 0;
+            w = PrintSpec(out + n, size, spec, stars, nstars, arg.d);
+        }
+        if (w > 0) {
+            n += w < size ? w : size - 1;
+        }
+    }
+    out[n] = 0;
+    return n;
+}
+
+//appends at most the free space of buffer, returns the new length
+static int AppendText(char buffer[LOG_STR_LEN], int len, const char* text, int text_len)
+{
+    if (text_len > LOG_STR_LEN - 1 - len) {
+        text_len = LOG_STR_LEN - 1 - len;
+    }
+    if (text_len > 0) {
+        memcpy(buffer + len, text, text_len);
+        len += text_len;
+    }
+    buffer[len] = 0;
+    return len;
+}
+
+int CLogger::FormatRecord(char buffer[LOG_STR_LEN], const SLogRecord& rec, const char* msg, int msg_len)
+{
+    int len = 0;
+    if (msg_len >= LOG_STR_LEN) {
+        msg_len = LOG_STR_LEN - 1;
+    }
     switch (m_formatter) {
     case LOG_FORMATTER::TEXT:
-        len = TextFormatter(buffer, level, file, function, line);
-        len += vsnprintf(buffer + len, LOG_STR_LEN, format, args);
+        len = TextFormatter(buffer, rec);
+        len = AppendText(buffer, len, msg, msg_len);
         break;
     case LOG_FORMATTER::COLORTEXT:
-        len = ColorTextFormatter(buffer, level, file, function, line);
-        len += snprintf(buffer + len, LOG_STR_LEN, COLOR_L_YELLOW_TEXT);
-        len += vsnprintf(buffer + len, LOG_STR_LEN, format, args);
-        len += snprintf(buffer + len, LOG_STR_LEN, COLOR_END);
+        len = ColorTextFormatter(buffer, rec);
+        len = AppendText(buffer, len, COLOR_L_YELLOW_TEXT, sizeof(COLOR_L_YELLOW_TEXT) - 1);
+        len = AppendText(buffer, len, msg, msg_len);
+        len = AppendText(buffer, len, COLOR_END, sizeof(COLOR_END) - 1);
         break;
     case LOG_FORMATTER::EXCEL:
-        len = ExcelFormatter(buffer, level, file, function, line);
-        len += vsnprintf(buffer + len, LOG_STR_LEN, format, args);
+        len = ExcelFormatter(buffer, rec);
+        len = AppendText(buffer, len, msg, msg_len);
         break;
     default:
+        break;
+    }
+    return len;
+}
+
+void CLogger::SetAsync(bool async, LOG_OVERFLOW policy, size_t capacity)
+{
+    if (m_async) {
+        //new records go the synchronous way, the ones being queued are waited for,
+        //then the writer drains the queue and stops
+        m_async = false;
+        while (m_producers.load()) {
+            this_thread::yield();
+        }
+        m_stop = true;
+        m_wake.notify_one();
+        m_writer.join();
+        m_queue.reset();
+        lock_guard lock(m_Mutex);
+        for (auto const& Wr : m_Wr) {
+            Wr->Flush();
+        }
+    }
+    if (!async) {
+        return;
+    }
+    m_overflow = policy;
+    m_queue.reset(new TRingBuffer<SLogRecord>(capacity));
+    m_stop = false;
+    m_writer = thread(&CLogger::WriterLoop, this);
+    m_async = true;
+}
+
+bool CLogger::EnterAsync()
+{
+    if (!m_async.load(memory_order_relaxed)) {
+        return false;
+    }
+    //sequentially consistent with SetAsync(): either it sees this producer
+    //and waits for it, or the producer sees the mode switched off
+    m_producers.fetch_add(1);
+    if (m_async.load()) {
+        return true;
+    }
+    m_producers.fetch_sub(1);
+    return false;
+}
+
+SLogRecord* CLogger::Claim()
+{
+    SLogRecord* rec;
+    while (!(rec = m_queue->Claim())) {
+        if (m_overflow == LOG_OVERFLOW::DROP) {
+            m_dropped++;
+            return nullptr;
+        }
+        if (m_overflow == LOG_OVERFLOW::OVERWRITE) {
+            //the queue is multi-consumer, a producer can discard the oldest record itself
+            SLogRecord* old = m_queue->Take();
+            if (old) {
+                m_queue->Release(old);
+                m_overwritten++;
+                m_written++;
+            }
+            continue;
+        }
+        if (m_sleeping) {
+            m_wake.notify_one();
+        }
+        this_thread::yield();
+    }
+    return rec;
+}
+
+void CLogger::Publish(SLogRecord* rec)
+{
+    m_queued++;
+    m_queue->Publish(rec);
+    if (m_sleeping) {
+        m_wake.notify_one();
+    }
+}
+
+void CLogger::Enqueue(int level, const char* file, const char* function, int line, const char* format, va_list args)
+{
+    //only the user message is formatted here, the header is formatted by the writer thread
+    SLogRecord* rec = Claim();
+    if (!rec) {
+        return;
+    }
+    Capture(*rec, level, file, function, line);
+    rec->len = vsnprintf(rec->msg, LOG_STR_LEN, format, args);
+    Count(level, rec->len);
+    Publish(rec);
+}
+
+void CLogger::WriterLoop()
+{
+    bool dirty = false;
+    while (1) {
+        SLogRecord* rec = m_queue->Take();
+        if (rec) {
+            {
+                auto lock = Lock();
+                WriteRecord(*rec);
+            }
+            m_queue->Release(rec);
+            m_written++;
+            dirty = true;
+            continue;
+        }
+        if (m_stop) {
+            //producers are gone, the queue is drained
+            return;
+        }
+        if (dirty) {
+            //idle, write the buffered records out
+            lock_guard lock(m_Mutex);
+            for (auto const& Wr : m_Wr) {
+                Wr->Flush();
+            }
+            dirty = false;
+            continue;
+        }
+        //nothing to write, sleep until a producer wakes us up,
+        //the timeout covers a wake up that raced with falling asleep
+        unique_lock lock(m_wake_mutex);
+        m_sleeping = true;
+        m_wake.wait_for(lock, chrono::milliseconds(10));
+        m_sleeping = false;
+    }
+}
+
+void CLogger::Flush()
+{
+    if (!m_async) {
         return;
     }
+    while (m_written < m_queued) {
+        m_wake.notify_one();
+        this_thread::yield();
+    }
+    lock_guard lock(m_Mutex);
     for (auto const& Wr : m_Wr) {
-        Wr->Write(buffer, len);
+        Wr->Flush();
     }
-    va_end(args);
 }
 
-int CLogger::printTime(char buffer[LOG_STR_LEN], int len)
+//"<prefix><n> ", cut to the free space of buffer
+static int AppendNumber(char buffer[LOG_STR_LEN], int len, const char* prefix, int prefix_len, uint32_t n)
 {
-#ifdef _WIN32
-	SYSTEMTIME time;
-	GetSystemTime(&time);
-	len += snprintf(buffer + len, LOG_STR_LEN, "%02d:%02d:%02d:%04d ",
-		time.wHour, time.wMinute, time.wSecond, time.wMilliseconds);
-#else //_WIN32
-	struct timeval tv;
-	struct tm *tm;
-	gettimeofday(&tv, NULL);
-	tm=localtime(&tv.tv_sec);
-	int32_t ms = (tv.tv_usec / 1000);
-	len += snprintf(buffer + len, LOG_STR_LEN, "%02d:%02d:%02d:%04d ",
-			tm->tm_hour, tm->tm_min, tm->tm_sec, ms);
-#endif //_WIN32
-    return len;
+    char text[24];
+    memcpy(text, prefix, prefix_len);
+    char* end = to_chars(text + prefix_len, text + sizeof(text) - 1, n).ptr;
+    *end++ = ' ';
+    return AppendText(buffer, len, text, (int)(end - text));
 }
 
-int CLogger::printThreadID(char buffer[LOG_STR_LEN], int len)
+int CLogger::printTime(char buffer[LOG_STR_LEN], int len, const SLogRecord& rec)
 {
+    int64_t sec = rec.time_us / 1000000;
+    int32_t ms = (int32_t)(rec.time_us % 1000000 / 1000);
+    if (sec != m_time_sec) {
+        //"hh:mm:ss:" changes once a second
+        time_t t = (time_t)sec;
+        struct tm tm;
 #ifdef _WIN32
-    DWORD tid = GetCurrentThreadId();
+        //GetSystemTime() reported UTC
+        gmtime_s(&tm, &t);
 #else //_WIN32
-    pid_t tid = syscall(SYS_gettid);
+        localtime_r(&t, &tm);
 #endif //_WIN32
-    len += snprintf(buffer + len, LOG_STR_LEN, "tid:%d ", tid);
-    return len;
+        snprintf(m_time_text, sizeof(m_time_text), "%02d:%02d:%02d:", tm.tm_hour, tm.tm_min, tm.tm_sec);
+        m_time_sec = sec;
+    }
+    char text[sizeof(m_time_text) + 5];
+    memcpy(text, m_time_text, 9);
+    text[9] = '0';
+    text[10] = (char)('0' + ms / 100);
+    text[11] = (char)('0' + ms / 10 % 10);
+    text[12] = (char)('0' + ms % 10);
+    text[13] = ' ';
+    return AppendText(buffer, len, text, 14);
+}
+
+int CLogger::printThreadID(char buffer[LOG_STR_LEN], int len, const SLogRecord& rec)
+{
+    return AppendNumber(buffer, len, "tid:", 4, rec.tid);
 }
 
-int CLogger::printProcessID(char buffer[LOG_STR_LEN], int len)
+int CLogger::printProcessID(char buffer[LOG_STR_LEN], int len, const SLogRecord& rec)
 {
+    return AppendNumber(buffer, len, "pid:", 4, rec.pid);
+}
+
+void CLogger::Metrics(SLogMetrics& m) const
+{
+    for (int i = 0; i <= LOG_LEVELS; i++) {
+        m.records[i] = m_level_records[i].load(memory_order_relaxed);
+        m.bytes[i] = m_level_bytes[i].load(memory_order_relaxed);
+    }
+    m.dropped = m_dropped;
+    m.overwritten = m_overwritten;
+    m.truncated = m_truncated;
+    m.mutex_waits = m_mutex_waits;
+    m.mutex_wait_ns = m_mutex_wait_ns;
+}
+
+void CLogger::WriteMetrics(string& out)
+{
+    static const char* levels[LOG_LEVELS + 1] = { "trace", "debug", "info", "warn", "error", "fatal", "other" };
+    SLogMetrics m;
+    Metrics(m);
+    char line[256];
+    for (int i = 0; i <= LOG_LEVELS; i++) {
+        snprintf(line, sizeof(line), "calc_log_records_total{level=\"%s\"} %llu\n", levels[i], (unsigned long long)m.records[i]);
+        out += line;
+    }
+    for (int i = 0; i <= LOG_LEVELS; i++) {
+        snprintf(line, sizeof(line), "calc_log_bytes_total{level=\"%s\"} %llu\n", levels[i], (unsigned long long)m.bytes[i]);
+        out += line;
+    }
+    snprintf(line, sizeof(line),
+        "calc_log_dropped_total %llu\n"
+        "calc_log_overwritten_total %llu\n"
+        "calc_log_truncated_total %llu\n"
+        "calc_log_mutex_waits_total %llu\n"
+        "calc_log_mutex_wait_ns_total %llu\n",
+        (unsigned long long)m.dropped, (unsigned long long)m.overwritten, (unsigned long long)m.truncated,
+        (unsigned long long)m.mutex_waits, (unsigned long long)m.mutex_wait_ns);
+    out += line;
+    if (EnterAsync()) {
+        snprintf(line, sizeof(line), "calc_log_queue_size %llu\n", (unsigned long long)m_queue->Size());
+        out += line;
+        LeaveAsync();
+    }
+    {
+        lock_guard lock(m_Mutex);
+        for (size_t i = 0; i < m_Wr.size(); i++) {
+            snprintf(line, sizeof(line),
+                "calc_log_writer_records_total{writer=\"%zu\",type=\"%s\"} %llu\n"
+                "calc_log_writer_bytes_total{writer=\"%zu\",type=\"%s\"} %llu\n",
+                i, m_Wr[i]->Name(), (unsigned long long)m_Wr[i]->Records(),
+                i, m_Wr[i]->Name(), (unsigned long long)m_Wr[i]->Bytes());
+            out += line;
+        }
+    }
+    m_latency.Write(out, "calc_log_latency_ns");
+}
+
+bool CLogger::DumpMetrics(const string& name)
+{
+    string out;
+    WriteMetrics(out);
+    //readers never see a half written file
+    string tmp = name + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+    ok = fclose(f) == 0 && ok;
 #ifdef _WIN32
-    DWORD pid = GetProcessId(GetCurrentProcess());
-#else //_WIN32
-    pid_t pid = getpid();
+    remove(name.c_str());
 #endif //_WIN32
-    len += snprintf(buffer + len, LOG_STR_LEN, "pid:%d ", pid);
-    return len;
+    return ok && rename(tmp.c_str(), name.c_str()) == 0;
+}
+
+void CLogger::SetMetricsFile(const string& name, uint32_t interval_ms)
+{
+    StopTimer();
+    m_metrics_file = name;
+    m_metrics_interval = interval_ms ? interval_ms : 1000;
+    StartTimer();
+}
+
+void CLogger::StartTimer()
+{
+    if (!m_timer_thread.joinable() && (m_metrics_file.size() || m_tick_ms)) {
+        m_timer_stop = false;
+        m_timer_thread = thread(&CLogger::TimerLoop, this);
+    }
+}
+
+void CLogger::StopTimer()
+{
+    if (!m_timer_thread.joinable()) {
+        return;
+    }
+    {
+        lock_guard lock(m_timer_mutex);
+        m_timer_stop = true;
+    }
+    m_timer_wake.notify_one();
+    m_timer_thread.join();
+    if (m_metrics_file.size()) {
+        //final numbers
+        DumpMetrics(m_metrics_file);
+    }
+}
+
+void CLogger::TimerLoop()
+{
+    typedef chrono::steady_clock clock;
+    clock::time_point next_dump = clock::now() + chrono::milliseconds(m_metrics_interval);
+    clock::time_point next_tick = clock::now();
+    unique_lock lock(m_timer_mutex);
+    while (1) {
+        clock::time_point wake = next_dump;
+        if (m_tick_ms && (m_metrics_file.empty() || next_tick < wake)) {
+            wake = next_tick;
+        }
+        if (m_timer_wake.wait_until(lock, wake, [this] { return m_timer_stop; })) {
+            return;
+        }
+        clock::time_point now = clock::now();
+        if (m_metrics_file.size() && now >= next_dump) {
+            DumpMetrics(m_metrics_file);
+            next_dump = now + chrono::milliseconds(m_metrics_interval);
+        }
+        if (m_tick_ms && now >= next_tick) {
+            lock_guard writers(m_Mutex);
+            for (auto const& Wr : m_Wr) {
+                Wr->Tick();
+            }
+            next_tick = now + chrono::milliseconds(m_tick_ms);
+        }
+    }
 }
 
-int CLogger::TextFormatter(char buffer[LOG_STR_LEN], int level, const char* file, const char* function, int line)
+//the default layout, built without snprintf
+int CLogger::TextFormatter(char buffer[LOG_STR_LEN], const SLogRecord& rec)
 {
     int len = 0;
     if (CLogger::m_format_mask & LOG_LOG_NUM) {
-        len += snprintf(buffer + len, LOG_STR_LEN, "%d ", CLogger::m_line_num++);
+        len = AppendNumber(buffer, len, "", 0, CLogger::m_line_num++);
     }
     if (CLogger::m_format_mask & LOG_TIME_STAMP) {
-    	len = printTime(buffer, len);
+    	len = printTime(buffer, len, rec);
     }
     if (CLogger::m_format_mask & LOG_PROC_ID) {
-    	len = printProcessID(buffer, len);
+    	len = printProcessID(buffer, len, rec);
     }
     if (CLogger::m_format_mask & LOG_THREAD_ID) {
-    	len = printThreadID(buffer, len);
+    	len = printThreadID(buffer, len, rec);
     }
-    switch (level) {
+    switch (rec.level) {
     case LOG_TRACE:
-        len += snprintf(buffer + len, LOG_STR_LEN, "(TRACE: ");
+        len = AppendText(buffer, len, "(TRACE: ", 8);
         break;
     case LOG_DEBUG:
-        len += snprintf(buffer + len, LOG_STR_LEN, "(DEBUG: ");
+        len = AppendText(buffer, len, "(DEBUG: ", 8);
         break;
     case LOG_INFO:
-        len += snprintf(buffer + len, LOG_STR_LEN, "(INFO : ");
+        len = AppendText(buffer, len, "(INFO : ", 8);
         break;
     case LOG_WARN:
-        len += snprintf(buffer + len, LOG_STR_LEN, "(WARN : ");
+        len = AppendText(buffer, len, "(WARN : ", 8);
         break;
     case LOG_ERROR:
-        len += snprintf(buffer + len, LOG_STR_LEN, "(ERROR: ");
+        len = AppendText(buffer, len, "(ERROR: ", 8);
         break;
     case LOG_FATAL:
-        len += snprintf(buffer + len, LOG_STR_LEN, "(FATAL: ");
+        len = AppendText(buffer, len, "(FATAL: ", 8);
         break;
     default:
         break;
     }
     if (CLogger::m_format_mask & LOG_FILE_NAME) {
-        len += snprintf(buffer + len, LOG_STR_LEN, "%s ", file);
+        len = AppendText(buffer, len, rec.file, (int)strlen(rec.file));
+        len = AppendText(buffer, len, " ", 1);
     }
     if (CLogger::m_format_mask & LOG_FUNC_MAME) {
-        len += snprintf(buffer + len, LOG_STR_LEN, "%s", function);
+        len = AppendText(buffer, len, rec.function, (int)strlen(rec.function));
     }
     if (CLogger::m_format_mask & LOG_LINE_NUM) {
-        len += snprintf(buffer + len, LOG_STR_LEN, ":%d ", line);
+        len = AppendNumber(buffer, len, ":", 1, (uint32_t)rec.line);
     }
     else {
-        len += snprintf(buffer + len, LOG_STR_LEN, " ");
+        len = AppendText(buffer, len, " ", 1);
     }
     return len;
 }
 
-int CLogger::ColorTextFormatter(char buffer[LOG_STR_LEN], int level, const char* file, const char* function, int line)
+int CLogger::ColorTextFormatter(char buffer[LOG_STR_LEN], const SLogRecord& rec)
 {
     int len = 0;
     if (CLogger::m_format_mask & LOG_LOG_NUM) {
-        len += snprintf(buffer + len, LOG_STR_LEN, COLOR_BLUE_TEXT "%d " COLOR_END, CLogger::m_line_num++);
+        len += snprintf(buffer + len, LOG_STR_LEN - len, COLOR_BLUE_TEXT "%d " COLOR_END, CLogger::m_line_num++);
     }
     if (CLogger::m_format_mask & LOG_TIME_STAMP) {
-    	len = printTime(buffer, len);
+    	len = printTime(buffer, len, rec);
     }
     if (CLogger::m_format_mask & LOG_PROC_ID) {
-    	len = printProcessID(buffer, len);
+    	len = printProcessID(buffer, len, rec);
     }
     if (CLogger::m_format_mask & LOG_THREAD_ID) {
-    	len = printThreadID(buffer, len);
+    	len = printThreadID(buffer, len, rec);
     }
-    switch (level) {
+    switch (rec.level) {
     case LOG_TRACE:
-        len += snprintf(buffer + len, LOG_STR_LEN, COLOR_WHITE_TEXT "(TRACE: " COLOR_END);
+        len += snprintf(buffer + len, LOG_STR_LEN - len, COLOR_WHITE_TEXT "(TRACE: " COLOR_END);
         break;
     case LOG_DEBUG:
-        len += snprintf(buffer + len, LOG_STR_LEN, COLOR_GREEN_TEXT "(DEBUG: " COLOR_END);
+        len += snprintf(buffer + len, LOG_STR_LEN - len, COLOR_GREEN_TEXT "(DEBUG: " COLOR_END);
         break;
     case LOG_INFO:
-        len += snprintf(buffer + len, LOG_STR_LEN, COLOR_GREEN_TEXT "(INFO : " COLOR_END);
+        len += snprintf(buffer + len, LOG_STR_LEN - len, COLOR_GREEN_TEXT "(INFO : " COLOR_END);
         break;
     case LOG_WARN:
-        len += snprintf(buffer + len, LOG_STR_LEN, COLOR_GREEN_TEXT "(WARN : " COLOR_END);
+        len += snprintf(buffer + len, LOG_STR_LEN - len, COLOR_GREEN_TEXT "(WARN : " COLOR_END);
         break;
     case LOG_ERROR:
-        len += snprintf(buffer + len, LOG_STR_LEN, COLOR_RED_TEXT "(ERROR: " COLOR_END);
+        len += snprintf(buffer + len, LOG_STR_LEN - len, COLOR_RED_TEXT "(ERROR: " COLOR_END);
         break;
     case LOG_FATAL:
-        len += snprintf(buffer + len, LOG_STR_LEN, COLOR_RED_TEXT "(FATAL: " COLOR_END);
+        len += snprintf(buffer + len, LOG_STR_LEN - len, COLOR_RED_TEXT "(FATAL: " COLOR_END);
         break;
     default:
         break;
     }
     if (CLogger::m_format_mask & LOG_FILE_NAME) {
-        len += snprintf(buffer + len, LOG_STR_LEN, COLOR_L_BLUE_TEXT "%s " COLOR_END, file);
+        len += snprintf(buffer + len, LOG_STR_LEN - len, COLOR_L_BLUE_TEXT "%s " COLOR_END, rec.file);
     }
     if (CLogger::m_format_mask & LOG_FUNC_MAME) {
-        len += snprintf(buffer + len, LOG_STR_LEN, COLOR_L_BLUE_TEXT "%s" COLOR_END, function);
+        len += snprintf(buffer + len, LOG_STR_LEN - len, COLOR_L_BLUE_TEXT "%s" COLOR_END, rec.function);
     }
     if (CLogger::m_format_mask & LOG_LINE_NUM) {
-        len += snprintf(buffer + len, LOG_STR_LEN, COLOR_L_BLUE_TEXT ":%d " COLOR_END, line);
+        len += snprintf(buffer + len, LOG_STR_LEN - len, COLOR_L_BLUE_TEXT ":%d " COLOR_END, rec.line);
     }
     else {
-        len += snprintf(buffer + len, LOG_STR_LEN, " ");
+        len += snprintf(buffer + len, LOG_STR_LEN - len, " ");
     }
 
     return len;
 }
 
-int CLogger::ExcelFormatter(char buffer[LOG_STR_LEN], int level, const char* file, const char* function, int line)
+int CLogger::ExcelFormatter(char buffer[LOG_STR_LEN], const SLogRecord& rec)
 {
     int len = 0;
     if (CLogger::m_format_mask & LOG_LOG_NUM) {
-        len += snprintf(buffer + len, LOG_STR_LEN, "%d;", CLogger::m_line_num++);
+        len += snprintf(buffer + len, LOG_STR_LEN - len, "%d;", CLogger::m_line_num++);
     }
     if (CLogger::m_format_mask & LOG_TIME_STAMP) {
-    	len = printTime(buffer, len);
+    	len = printTime(buffer, len, rec);
     }
     if (CLogger::m_format_mask & LOG_PROC_ID) {
-    	len = printProcessID(buffer, len);
+    	len = printProcessID(buffer, len, rec);
     }
     if (CLogger::m_format_mask & LOG_THREAD_ID) {
-    	len = printThreadID(buffer, len);
+    	len = printThreadID(buffer, len, rec);
     }
-    switch (level) {
+    switch (rec.level) {
     case LOG_TRACE:
-        len += snprintf(buffer + len, LOG_STR_LEN, "(TRACE:;");
+        len += snprintf(buffer + len, LOG_STR_LEN - len, "(TRACE:;");
         break;
     case LOG_DEBUG:
-        len += snprintf(buffer + len, LOG_STR_LEN, "(DEBUG:;");
+        len += snprintf(buffer + len, LOG_STR_LEN - len, "(DEBUG:;");
         break;
     case LOG_INFO:
-        len += snprintf(buffer + len, LOG_STR_LEN, "(INFO :;");
+        len += snprintf(buffer + len, LOG_STR_LEN - len, "(INFO :;");
         break;
     case LOG_WARN:
-        len += snprintf(buffer + len, LOG_STR_LEN, "(WARN :;");
+        len += snprintf(buffer + len, LOG_STR_LEN - len, "(WARN :;");
         break;
     case LOG_ERROR:
-        len += snprintf(buffer + len, LOG_STR_LEN, "(ERROR:;");
+        len += snprintf(buffer + len, LOG_STR_LEN - len, "(ERROR:;");
         break;
     case LOG_FATAL:
-        len += snprintf(buffer + len, LOG_STR_LEN, "(FATAL:;");
+        len += snprintf(buffer + len, LOG_STR_LEN - len, "(FATAL:;");
         break;
     default:
         break;
     }
     if (CLogger::m_format_mask & LOG_FILE_NAME) {
-        len += snprintf(buffer + len, LOG_STR_LEN, "%s;", file);
+        len += snprintf(buffer + len, LOG_STR_LEN - len, "%s;", rec.file);
     }
     if (CLogger::m_format_mask & LOG_FUNC_MAME) {
-        len += snprintf(buffer + len, LOG_STR_LEN, "%s;", function);
+        len += snprintf(buffer + len, LOG_STR_LEN - len, "%s;", rec.function);
     }
     if (CLogger::m_format_mask & LOG_LINE_NUM) {
-        len += snprintf(buffer + len, LOG_STR_LEN, "%d;", line);
+        len += snprintf(buffer + len, LOG_STR_LEN - len, "%d;", rec.line);
     }
     return len;
 }
@@ -345,7 +1259,7 @@ void CLogger::Dump(const void* data, unsigned int len)
 //Writer classes
 void CConsoleWriter::Write(const char* buff, const int len)
 {
-    printf("%s", buff);
+    fwrite(buff, 1, len, stdout);
 }
 
 void CConsoleWriter::Write(const string& sMessage)
@@ -353,25 +1267,193 @@ void CConsoleWriter::Write(const string& sMessage)
     cout << sMessage;
 }
 
-CFileWriter::CFileWriter(const string& name)
+void CConsoleWriter::Flush()
+{
+    fflush(stdout);
+}
+
+#ifdef _WIN32
+#define open _open
+#define close _close
+#define O_WRONLY _O_WRONLY
+#define O_CREAT _O_CREAT
+#define O_TRUNC _O_TRUNC
+#endif //_WIN32
+
+CFileWriter::CFileWriter(const string& name, bool binary, const SLogFileOptions& options) :
+    m_name(name), m_binary(binary), m_options(options), m_buffer(options.buffer)
 {
-    m_file.open(name);
+    struct stat st;
+    if ((m_options.max_size || m_options.max_age) && stat(name.c_str(), &st) == 0 && st.st_size > 0) {
+        //keep the log of the previous run
+        Shift();
+    }
+    Open();
 }
 
 CFileWriter::~CFileWriter()
 {
-    m_file.close();
+    WriteOut(nullptr, 0);
+    Close();
 }
 
-void CFileWriter::Write(const char* buff, const int len)
+void CFileWriter::Open()
 {
-    string sMessage(buff, len);
-    m_file << sMessage;
+#ifdef _WIN32
+    m_fd = open(m_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | (m_binary ? _O_BINARY : _O_TEXT), _S_IREAD | _S_IWRITE);
+#else //_WIN32
+    m_fd = open(m_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif //_WIN32
+    m_size = 0;
+    m_opened = m_synced = chrono::steady_clock::now();
+}
+
+void CFileWriter::Close()
+{
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+void CFileWriter::Shift()
+{
+    //name -> name.1 -> ... -> name.max_files, the oldest one is removed
+    string last = m_name + "." + to_string(m_options.max_files);
+    remove(m_options.max_files ? last.c_str() : m_name.c_str());
+    for (uint32_t i = m_options.max_files; i > 1; i--) {
+        rename((m_name + "." + to_string(i - 1)).c_str(), (m_name + "." + to_string(i)).c_str());
+    }
+    if (m_options.max_files) {
+        rename(m_name.c_str(), (m_name + ".1").c_str());
+    }
 }
 
-void CFileWriter::Write(const string& sMessage)
+bool CFileWriter::Rotate(int len)
 {
-    m_file << sMessage;
+    if (m_fd < 0) {
+        return false;
+    }
+    bool full = m_options.max_size && m_size && m_size + len > m_options.max_size;
+    bool old = m_options.max_age &&
+        chrono::steady_clock::now() - m_opened >= chrono::seconds(m_options.max_age);
+    if (!full && !old) {
+        return false;
+    }
+    WriteOut(nullptr, 0);
+    if (m_options.fsync != LOG_FSYNC::NEVER) {
+        Sync();
+    }
+    Close();
+    Shift();
+    Open();
+    return true;
+}
+
+void CFileWriter::Write(const char* buff, const int len, int level)
+{
+    if (m_fd < 0 || len <= 0) {
+        return;
+    }
+    Rotate(len);
+    if (m_used + len > m_buffer.size()) {
+        WriteOut(buff, len);
+    }
+    else {
+        memcpy(m_buffer.data() + m_used, buff, len);
+        m_used += len;
+    }
+    m_size += len;
+    m_dirty = true;
+    if (level & (LOG_ERROR | LOG_FATAL)) {
+        //don't keep errors in the buffer, the process may be about to die
+        WriteOut(nullptr, 0);
+        if (m_options.fsync == LOG_FSYNC::ERRORS) {
+            Sync();
+        }
+    }
+    if (m_options.fsync == LOG_FSYNC::INTERVAL &&
+        chrono::steady_clock::now() - m_synced >= chrono::milliseconds(m_options.fsync_ms)) {
+        WriteOut(nullptr, 0);
+        Sync();
+    }
+}
+
+void CFileWriter::WriteOut(const char* data, size_t len)
+{
+    if (m_fd < 0 || (!m_used && !len)) {
+        m_used = 0;
+        return;
+    }
+#ifdef _WIN32
+    if (m_used) {
+        _write(m_fd, m_buffer.data(), (unsigned int)m_used);
+    }
+    if (len) {
+        _write(m_fd, data, (unsigned int)len);
+    }
+#else //_WIN32
+    struct iovec iov[2] = { { m_buffer.data(), m_used }, { (void*)data, len } };
+    struct iovec* v = m_used ? iov : iov + 1;
+    int count = (m_used ? 1 : 0) + (len ? 1 : 0);
+    while (count) {
+        ssize_t n = writev(m_fd, v, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        //partial write, skip what is written
+        while (count && (size_t)n >= v->iov_len) {
+            n -= v->iov_len;
+            v++;
+            count--;
+        }
+        if (count) {
+            v->iov_base = (char*)v->iov_base + n;
+            v->iov_len -= n;
+        }
+    }
+#endif //_WIN32
+    m_used = 0;
+}
+
+void CFileWriter::Sync()
+{
+#ifdef _WIN32
+    _commit(m_fd);
+#else //_WIN32
+    fsync(m_fd);
+#endif //_WIN32
+    m_synced = chrono::steady_clock::now();
+    m_dirty = false;
+}
+
+uint32_t CFileWriter::TickMs() const
+{
+    //half the interval: a record waits at most fsync_ms for its turn plus one period
+    if (m_options.fsync != LOG_FSYNC::INTERVAL) {
+        return 0;
+    }
+    return m_options.fsync_ms > 1 ? m_options.fsync_ms / 2 : 1;
+}
+
+void CFileWriter::Tick()
+{
+    //Write() keeps the interval only while records come in
+    if (m_dirty && chrono::steady_clock::now() - m_synced >= chrono::milliseconds(m_options.fsync_ms)) {
+        WriteOut(nullptr, 0);
+        Sync();
+    }
+}
+
+void CFileWriter::Flush()
+{
+    WriteOut(nullptr, 0);
+    if (m_options.fsync != LOG_FSYNC::NEVER) {
+        Sync();
+    }
 }
 
-#endif //_DEBUG
+#endif //CALC_LOGGING
@@ -19,18 +19,38 @@
 #define COLOR_WHITE_BKG_L_MGNTA_TEXT  "\033[2;47;35m"
 #define COLOR_WHITE_BKG_RED_TEXT      "\033[1;47;35m"
 
-#ifdef _DEBUG
+//logging is compiled in debug builds, CALC_LOGGING turns it on in release builds too
+#if defined(_DEBUG) && !defined(CALC_LOGGING)
+#define CALC_LOGGING
+#endif
+
+#ifdef CALC_LOGGING
 
 #include <vector>
 #include <memory>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <mutex>
+#include <cstdarg>
+#include <chrono>
+#include <type_traits>
+#include <stdint.h>
+#include <string.h>
 #include "TSingletone.hpp"
+#include "TRingBuffer.hpp"
+#include "CHistogram.h"
 
 using namespace std;
 
 #define LOG_STR_LEN 1024
+//default number of records in the asynchronous queue
+#define LOG_QUEUE_SIZE 4096
+//default user space buffer of a log file
+#define LOG_FILE_BUFFER (256 * 1024)
 
 //log levels
 #define LOG_NONE   0x00
@@ -41,6 +61,10 @@ using namespace std;
 #define LOG_ERROR  0x10
 #define LOG_FATAL  0x20
 #define LOG_ALL_LEVELS  (LOG_TRACE | LOG_DEBUG | LOG_INFO | LOG_WARN | LOG_ERROR | LOG_FATAL)
+//calls below this level are removed at compile time
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_TRACE
+#endif
 //log columns
 #define LOG_FILE_NAME  0x01
 #define LOG_FUNC_MAME  0x02
@@ -54,7 +78,103 @@ using namespace std;
 enum class LOG_FORMATTER {
     TEXT,
     COLORTEXT,
-    EXCEL
+    EXCEL,
+    BINARY  //call site id, time and raw arguments, formatted offline by calc_logdecode
+};
+
+//binary log records, every record starts with its type byte, numbers are in native byte order
+#define LOG_BIN_MAGIC   "CLOGBIN"
+#define LOG_BIN_VERSION 1
+#define LOG_BIN_HEADER  'H' //magic, version
+#define LOG_BIN_SITE    'S' //u32 id, i32 level, i32 line, file, function, format (u16 length + bytes)
+#define LOG_BIN_RECORD  'R' //u32 id, i64 time_us, u32 pid, u32 tid, u16 args length, args
+#define LOG_BIN_MESSAGE 'M' //i32 level, i32 line, i64 time_us, u32 pid, u32 tid, file, function, message
+//argument tags of the packed arguments
+#define LOG_ARG_INT    'i' //int64
+#define LOG_ARG_UINT   'u' //uint64
+#define LOG_ARG_DOUBLE 'd' //double
+#define LOG_ARG_STRING 's' //u16 length + bytes
+#define LOG_ARG_PTR    'p' //uint64
+
+#ifdef __GNUC__
+#define LOG_SIGNATURE __PRETTY_FUNCTION__
+#define LOG_PRINTF(fmt, args) __attribute__((format(printf, fmt, args)))
+#elif defined(_MSC_VER)
+#define LOG_SIGNATURE __FUNCSIG__
+#define LOG_PRINTF(fmt, args)
+#else
+#define LOG_SIGNATURE __FUNCTION__
+#define LOG_PRINTF(fmt, args)
+#endif
+
+//call site states
+#define LOG_SITE_NEW 0 //not registered yet
+#define LOG_SITE_ON  1
+#define LOG_SITE_OFF 2
+
+//one per LOGx() call site, registered on its first enabled call
+struct SLogSite {
+    int level;
+    const char* file;
+    const char* function;
+    const char* signature; //with the class name and parameters, matched by SetSiteFilter
+    int line;
+    //filled when the site is registered
+    const char* format = nullptr;
+    uint32_t bounded = 0; //bit i: string argument i is bounded by the precision in argument i - 1 (%.*s)
+    atomic<uint32_t> id{ 0 };
+    atomic<uint8_t> state{ LOG_SITE_NEW };
+};
+
+//what an asynchronous producer does when the queue is full
+enum class LOG_OVERFLOW {
+    BLOCK,     //wait for the writer thread
+    DROP,      //drop the new record and count it
+    OVERWRITE  //drop the oldest queued record and count it
+};
+
+//when a log file is synced to the disk
+enum class LOG_FSYNC {
+    NEVER,    //left to the OS
+    INTERVAL, //at most every fsync_ms milliseconds, a record is on the disk 1.5 * fsync_ms after it at the latest
+    ERRORS    //after every ERROR and FATAL record
+};
+
+struct SLogFileOptions {
+    size_t buffer = LOG_FILE_BUFFER;
+    uint64_t max_size = 0;   //rotate before the file grows past it, 0 never
+    uint32_t max_age = 0;    //rotate files older than that many seconds, 0 never
+    uint32_t max_files = 5;  //rotated files kept: name.1 (newest) .. name.N
+    LOG_FSYNC fsync = LOG_FSYNC::NEVER;
+    uint32_t fsync_ms = 1000;
+};
+
+//index of the per level counters, LOG_LEVELS for an unknown level
+#define LOG_LEVELS 6
+
+//snapshot of the logger counters
+struct SLogMetrics {
+    uint64_t records[LOG_LEVELS + 1]; //messages per level
+    uint64_t bytes[LOG_LEVELS + 1];   //message bytes per level, without the header
+    uint64_t dropped;
+    uint64_t overwritten;
+    uint64_t truncated;     //messages cut at LOG_STR_LEN
+    uint64_t mutex_waits;   //contended lock acquisitions
+    uint64_t mutex_wait_ns;
+};
+
+//everything the formatters need, captured when the log call is made
+struct SLogRecord {
+    const SLogSite* site; //set for binary records, msg holds the packed arguments then
+    int level;
+    const char* file;
+    const char* function;
+    int line;
+    int64_t time_us; //system clock, microseconds since the epoch
+    uint32_t pid;
+    uint32_t tid;
+    int len;
+    char msg[LOG_STR_LEN];
 };
 
 class CLogWriter {
@@ -63,6 +183,30 @@ public:
     virtual ~CLogWriter() {}
     virtual void Write(const char* buff, const int len) = 0;
     virtual void Write(const string& sMessage) = 0;
+    virtual void Flush() {}
+    //takes the records of LOG_FORMATTER::BINARY, a text writer gets nothing in that mode
+    virtual bool Binary() const { return false; }
+    //one formatted record
+    virtual void Write(const char* buff, const int len, int /*level*/) { Write(buff, len); }
+    //starts a new file if len more bytes would not fit, a binary log has to repeat its header then
+    virtual bool Rotate(int /*len*/) { return false; }
+    //metrics label
+    virtual const char* Name() const { return "writer"; }
+    //period of the Tick() calls the writer needs, 0 for none
+    virtual uint32_t TickMs() const { return 0; }
+    //called by the timer thread of CLogger under the writer lock, also when nothing is logged
+    virtual void Tick() {}
+    uint64_t Records() const { return m_records.load(memory_order_relaxed); }
+    uint64_t Bytes() const { return m_bytes.load(memory_order_relaxed); }
+    //counted by CLogger
+    void Count(int len)
+    {
+        m_records.fetch_add(1, memory_order_relaxed);
+        m_bytes.fetch_add(len, memory_order_relaxed);
+    }
+private:
+    atomic<uint64_t> m_records{ 0 };
+    atomic<uint64_t> m_bytes{ 0 };
 };
 
 class CConsoleWriter : public CLogWriter {
@@ -71,21 +215,51 @@ public:
     virtual ~CConsoleWriter() {}
     void Write(const char* buff, const int len) override;
     void Write(const string& sMessage) override;
+    void Flush() override;
+    const char* Name() const override { return "console"; }
 };
 
+//Buffered log file. Records are collected in a user space buffer and written with one
+//write()/writev() when it fills up, on Flush() or as the fsync policy requires.
+//LOG_FSYNC::INTERVAL is kept by the timer thread too, an idle log does not hold records back.
 class CFileWriter : public CLogWriter {
 public:
     CFileWriter() = delete;
-    CFileWriter(const string& name);
+    CFileWriter(const string& name, bool binary = false, const SLogFileOptions& options = SLogFileOptions());
     virtual ~CFileWriter();
-    void Write(const char* buff, const int len) override;
-    void Write(const string& sMessage) override;
+    void Write(const char* buff, const int len) override { Write(buff, len, LOG_NONE); }
+    void Write(const string& sMessage) override { Write(sMessage.data(), (int)sMessage.size(), LOG_NONE); }
+    void Write(const char* buff, const int len, int level) override;
+    void Flush() override;
+    bool Binary() const override { return m_binary; }
+    bool Rotate(int len) override;
+    const char* Name() const override { return "file"; }
+    uint32_t TickMs() const override;
+    void Tick() override;
 private:
-    ofstream m_file;
+    string m_name;
+    bool m_binary;
+    SLogFileOptions m_options;
+    int m_fd = -1;
+    vector<char> m_buffer;
+    size_t m_used = 0;
+    uint64_t m_size = 0; //file size including the buffer
+    chrono::steady_clock::time_point m_opened;
+    chrono::steady_clock::time_point m_synced;
+    bool m_dirty = false; //written since the last Sync()
+
+    void Open();
+    void Close();
+    //renames the files to make room for a new one
+    void Shift();
+    //writes the buffer and then data, one system call when both are there
+    void WriteOut(const char* data, size_t len);
+    void Sync();
 };
 
 class CLogger final : public TSingleton<CLogger> {
     friend class TSingleton<CLogger>;
+    friend class CCalcBench;
 public:
     CLogger(CLogger const&) = delete;            // Copy construct
     CLogger(CLogger&&) = delete;                 // Move construct
@@ -95,13 +269,46 @@ public:
     void AddWriter(CLogWriter* lw);
 
     void Dump(const void* data, unsigned int len);
-    void Log(int level, const char* file, const char* function, int line, const char* format, ...);
+    void Log(int level, const char* file, const char* function, int line, const char* format, ...) LOG_PRINTF(6, 7);
+    //LOGx() entry, in BINARY mode only the arguments are copied, the format is applied offline
+    template<typename... A>
+    void Log(SLogSite& site, const char* format, A... args);
+    //writes a decoded record with the current formatter and writers
+    void Replay(const SLogRecord& rec);
+    //printf of packed arguments, returns the length written to out
+    static int FormatPacked(char out[LOG_STR_LEN], const char* format, const char* args, int len);
 
     void SetLevelMask(uint32_t mask) { m_level_mask = mask; }
     void SetFormatMask(uint32_t mask) { m_format_mask = mask; }
     void SetFormatter(LOG_FORMATTER val);
 
-    friend bool CheckLevelMask(uint32_t mask);
+    //In asynchronous mode Log() only copies the record into a lock-free queue,
+    //a background thread formats and writes it. Writers have to be added before.
+    void SetAsync(bool async, LOG_OVERFLOW policy = LOG_OVERFLOW::BLOCK, size_t capacity = LOG_QUEUE_SIZE);
+    //waits until every queued record is written
+    void Flush();
+    uint64_t Dropped() const { return m_dropped; }
+    uint64_t Overwritten() const { return m_overwritten; }
+
+    void Metrics(SLogMetrics& m) const;
+    //nanoseconds from the call into CLogger to its return, per message
+    const CHistogram& Latency() const { return m_latency; }
+    //counters, latency and writers in plain text, one "name{labels} value" per line
+    void WriteMetrics(string& out);
+    bool DumpMetrics(const string& name);
+    //dumps every interval_ms and at exit, an empty name stops it
+    void SetMetricsFile(const string& name, uint32_t interval_ms = 1000);
+
+    //Turns the call sites of a file ("CCalculator.cpp"), a function ("InfixToPostfix")
+    //or a method ("CCalculator::InfixToPostfix") on or off. Later filters win.
+    void SetSiteFilter(const string& pattern, bool enable);
+    //drops the filters and sets the state of unmatched sites
+    void ResetSiteFilters(bool enable = true);
+    //one line per call site of the program, also the ones that have not run yet
+    //(GCC and Clang; with other compilers a site is known after its first call)
+    void ListSites(string& out);
+
+    friend inline bool CheckLevelMask(uint32_t mask);
 private:
 #ifdef _WIN32
     void *hStdout;
@@ -113,32 +320,230 @@ private:
     inline static uint32_t m_level_mask  = LOG_ERROR | LOG_FATAL;
     inline static uint32_t m_format_mask = LOG_FILE_NAME | LOG_FUNC_MAME | LOG_LINE_NUM;
     inline static uint32_t m_line_num    = 0;
+    //record time base
+    chrono::steady_clock::time_point m_clock_base;
+    int64_t m_clock_base_us = 0;
+    //"hh:mm:ss:" of m_time_sec, reused by printTime() within the second
+    int64_t m_time_sec = -1;
+    char m_time_text[16];
+    //asynchronous mode
+    atomic<bool> m_async{ false };
+    //threads between EnterAsync() and LeaveAsync(), SetAsync() waits for them before the queue goes
+    atomic<uint32_t> m_producers{ 0 };
+    LOG_OVERFLOW m_overflow = LOG_OVERFLOW::BLOCK;
+    unique_ptr<TRingBuffer<SLogRecord>> m_queue;
+    thread m_writer;
+    atomic<bool> m_stop{ false };
+    atomic<bool> m_sleeping{ false };
+    mutex m_wake_mutex;
+    condition_variable m_wake;
+    atomic<uint64_t> m_queued{ 0 };
+    atomic<uint64_t> m_written{ 0 };
+    atomic<uint64_t> m_dropped{ 0 };
+    atomic<uint64_t> m_overwritten{ 0 };
+    //metrics
+    atomic<uint64_t> m_level_records[LOG_LEVELS + 1] = {};
+    atomic<uint64_t> m_level_bytes[LOG_LEVELS + 1] = {};
+    atomic<uint64_t> m_truncated{ 0 };
+    atomic<uint64_t> m_mutex_waits{ 0 };
+    atomic<uint64_t> m_mutex_wait_ns{ 0 };
+    CHistogram m_latency;
+    string m_metrics_file;
+    uint32_t m_metrics_interval = 1000;
+    //timer thread: metrics dumps and the Tick() of the writers
+    thread m_timer_thread;
+    uint32_t m_tick_ms = 0; //shortest TickMs() of the writers, 0 for none
+    bool m_timer_stop = false;
+    mutex m_timer_mutex;
+    condition_variable m_timer_wake;
+
     CLogger();
     ~CLogger();
-    int TextFormatter(char buffer[LOG_STR_LEN], int level, const char* file, const char* function, int line);
-    int ColorTextFormatter(char buffer[LOG_STR_LEN], int level, const char* file, const char* function, int line);
-    int ExcelFormatter(char buffer[LOG_STR_LEN], int level, const char* file, const char* function, int line);
-    int printTime(char buffer[LOG_STR_LEN], int len);
-    int printThreadID(char buffer[LOG_STR_LEN], int len);
-    int printProcessID(char buffer[LOG_STR_LEN], int len);
+    //call site registry
+    struct SSiteFilter {
+        string pattern;
+        bool enable;
+    };
+    vector<SLogSite*> m_sites;
+    size_t m_static_sites = 0; //LogStaticSites() entries added already
+    vector<SSiteFilter> m_filters;
+    bool m_sites_default = true;
+    //binary mode
+    atomic<uint32_t> m_site_count{ 0 };
+    vector<bool> m_site_written;
+    bool m_bin_started = false;
+    string m_bin;
+
+    unique_lock<mutex> Lock();
+    void Count(int level, int len);
+    //runs while there is a metrics file or a writer to tick
+    void StartTimer();
+    void StopTimer();
+    void TimerLoop();
+    void Capture(SLogRecord& rec, int level, const char* file, const char* function, int line);
+    //true when the queue may be used until LeaveAsync()
+    bool EnterAsync();
+    void LeaveAsync() { m_producers.fetch_sub(1); }
+    SLogRecord* Claim();
+    void Publish(SLogRecord* rec);
+    //the format of a call site was checked by LogFormatCheck() already
+    void LogText(const SLogSite& site, const char* format, ...);
+    void LogV(int level, const char* file, const char* function, int line, const char* format, va_list args);
+    void Enqueue(int level, const char* file, const char* function, int line, const char* format, va_list args);
+    void WriterLoop();
+    void WriteRecord(const SLogRecord& rec);
+    int FormatRecord(char buffer[LOG_STR_LEN], const SLogRecord& rec, const char* msg, int msg_len);
+    void EncodeRecord(const SLogRecord& rec);
+    void RegisterSite(SLogSite& site, const char* format);
+    //gives the site an id and puts it into m_sites once
+    void AddSite(SLogSite& site);
+    //takes the sites collected by LogAddStaticSite() before main()
+    void AddStaticSites();
+    bool SiteEnabled(const SLogSite& site);
+    void LogPacked(SLogSite& site, const char* args, int len);
+    template<typename T>
+    static int PackArg(char buf[LOG_STR_LEN], int len, const SLogSite& site, int index, int64_t& last, T value);
+    int TextFormatter(char buffer[LOG_STR_LEN], const SLogRecord& rec);
+    int ColorTextFormatter(char buffer[LOG_STR_LEN], const SLogRecord& rec);
+    int ExcelFormatter(char buffer[LOG_STR_LEN], const SLogRecord& rec);
+    int printTime(char buffer[LOG_STR_LEN], int len, const SLogRecord& rec);
+    int printThreadID(char buffer[LOG_STR_LEN], int len, const SLogRecord& rec);
+    int printProcessID(char buffer[LOG_STR_LEN], int len, const SLogRecord& rec);
 };
 
-bool CheckLevelMask(uint32_t mask);
+template<typename T>
+int CLogger::PackArg(char buf[LOG_STR_LEN], int len, const SLogSite& site, int index, int64_t& last, T value)
+{
+    //tag + 8 bytes, strings are cut to the free space
+    if (len > LOG_STR_LEN - 1 - 8) {
+        return len;
+    }
+    if constexpr (is_enum_v<T>) {
+        return PackArg(buf, len, site, index, last, (underlying_type_t<T>)value);
+    }
+    else if constexpr (is_integral_v<T>) {
+        if constexpr (is_signed_v<T>) {
+            int64_t v = value;
+            buf[len] = LOG_ARG_INT;
+            memcpy(buf + len + 1, &v, 8);
+            last = v;
+        }
+        else {
+            uint64_t v = value;
+            buf[len] = LOG_ARG_UINT;
+            memcpy(buf + len + 1, &v, 8);
+            last = (int64_t)v;
+        }
+        return len + 9;
+    }
+    else if constexpr (is_floating_point_v<T>) {
+        double v = value;
+        buf[len] = LOG_ARG_DOUBLE;
+        memcpy(buf + len + 1, &v, 8);
+        return len + 9;
+    }
+    else if constexpr (is_convertible_v<T, const char*>) {
+        const char* s = value ? value : "(null)";
+        size_t max = LOG_STR_LEN - 3 - len;
+        if (index < 32 && (site.bounded >> index & 1) && last >= 0 && (size_t)last < max) {
+            max = (size_t)last;
+        }
+        uint16_t n = (uint16_t)strnlen(s, max);
+        buf[len] = LOG_ARG_STRING;
+        memcpy(buf + len + 1, &n, 2);
+        memcpy(buf + len + 3, s, n);
+        return len + 3 + n;
+    }
+    else {
+        static_assert(is_pointer_v<T>, "unsupported log argument type");
+        uint64_t v = (uint64_t)(uintptr_t)value;
+        buf[len] = LOG_ARG_PTR;
+        memcpy(buf + len + 1, &v, 8);
+        return len + 9;
+    }
+}
+
+template<typename... A>
+void CLogger::Log(SLogSite& site, const char* format, A... args)
+{
+    if (site.state.load(memory_order_acquire) == LOG_SITE_NEW) {
+        RegisterSite(site, format);
+        if (site.state.load(memory_order_relaxed) == LOG_SITE_OFF) {
+            return;
+        }
+    }
+    if (m_formatter != LOG_FORMATTER::BINARY) {
+        LogText(site, format, args...);
+        return;
+    }
+    char buf[LOG_STR_LEN];
+    int len = 0;
+    int index = 0;
+    int64_t last = 0;
+    ((len = PackArg(buf, len, site, index++, last, args)), ...);
+    (void)index;
+    (void)last;
+    LogPacked(site, buf, len);
+}
+
+//inline, a disabled level costs a load and a test
+inline bool CheckLevelMask(uint32_t mask)
+{
+    return CLogger::m_level_mask & mask;
+}
+
+//never called, lets the compiler check the LOGx() arguments against the format
+inline void LogFormatCheck(const char*, ...) LOG_PRINTF(1, 2);
+inline void LogFormatCheck(const char*, ...) {}
+
 void LogInitConsole(LOG_FORMATTER formatter);
 void LogInitColorConsole();
-void LogInitTextFile(const string& name);
+void LogInitTextFile(const string& name, const SLogFileOptions& options = SLogFileOptions());
+void LogInitAsync(LOG_OVERFLOW policy);
+void LogInitBinaryFile(const string& name, const SLogFileOptions& options = SLogFileOptions());
+//comma separated patterns, "-pattern" turns sites off; if the first one turns
+//sites on, everything else is off: "CCalculator::InfixToPostfix,-CThreadPool.cpp"
+void LogInitSites(const string& spec);
+
+//collects a call site before main(), called by the initializer of TLogSiteRegistrar
+bool LogAddStaticSite(SLogSite* site);
+
+//A namespace scope object per call site: its initializer runs before main() whether
+//the site ever runs or not, so the registry knows every site of the program.
+//Sites in inline functions are merged by the linker, a template has one per instantiation.
+template<SLogSite* site, bool enabled>
+struct TLogSiteRegistrar {
+    static inline const bool registered = enabled && LogAddStaticSite(site);
+};
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LOG_STATIC_SITE(site, level) (void)TLogSiteRegistrar<&site, ((level) >= LOG_MIN_LEVEL)>::registered
+#else
+//the address of a function local static as a template argument is left to GCC and Clang,
+//elsewhere a site registers on its first call
+#define LOG_STATIC_SITE(site, level)
+#endif
 
 //The value of __FILE__ is the file path as specified on the compiler's command line. 
-#define LOGT(...) if (CheckLevelMask(LOG_TRACE)) CLogger::GetInstance().Log(LOG_TRACE, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__);
-#define LOGD(...) if (CheckLevelMask(LOG_DEBUG)) CLogger::GetInstance().Log(LOG_DEBUG, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__);
-#define LOGI(...) if (CheckLevelMask(LOG_INFO))  CLogger::GetInstance().Log(LOG_INFO,  __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__);
-#define LOGW(...) if (CheckLevelMask(LOG_WARN))  CLogger::GetInstance().Log(LOG_WARN,  __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__);
-#define LOGE(...) if (CheckLevelMask(LOG_ERROR)) CLogger::GetInstance().Log(LOG_ERROR, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__);
-#define LOGF(...) if (CheckLevelMask(LOG_FATAL)) CLogger::GetInstance().Log(LOG_FATAL, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__);
+//Levels below LOG_MIN_LEVEL are a constant false condition and compile to nothing.
+//An enabled call checks the state of its site, switched off sites cost one more load.
+#define LOG_SITE(level, ...) if ((level) >= LOG_MIN_LEVEL && CheckLevelMask(level)) { \
+    static SLogSite log_site_ = { level, __FILE__, __FUNCTION__, LOG_SIGNATURE, __LINE__ }; \
+    LOG_STATIC_SITE(log_site_, level); \
+    if (0) LogFormatCheck(__VA_ARGS__); \
+    if (log_site_.state.load(memory_order_relaxed) != LOG_SITE_OFF) \
+        CLogger::GetInstance().Log(log_site_, __VA_ARGS__); }
+#define LOGT(...) LOG_SITE(LOG_TRACE, __VA_ARGS__)
+#define LOGD(...) LOG_SITE(LOG_DEBUG, __VA_ARGS__)
+#define LOGI(...) LOG_SITE(LOG_INFO,  __VA_ARGS__)
+#define LOGW(...) LOG_SITE(LOG_WARN,  __VA_ARGS__)
+#define LOGE(...) LOG_SITE(LOG_ERROR, __VA_ARGS__)
+#define LOGF(...) LOG_SITE(LOG_FATAL, __VA_ARGS__)
 
 #define LOG_INIT_COLORCONSOLE LogInitColorConsole()
+#define LOG_FLUSH CLogger::GetInstance().Flush()
 
-#else  //_DEBUG
+#else  //CALC_LOGGING
 
 #define LOGT(...)
 #define LOGD(...)
@@ -148,5 +553,6 @@ void LogInitTextFile(const string& name);
 #define LOGF(...)
 
 #define LOG_INIT_COLORCONSOLE
+#define LOG_FLUSH
 
-#endif //_DEBUG
+#endif //CALC_LOGGING
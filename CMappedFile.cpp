@@ -0,0 +1,126 @@
+#ifdef _WIN32
+#include <windows.h>
+#else //_WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif //_WIN32
+
+#include "CMappedFile.h"
+#include "CLogger.h"
+
+CMappedFile::~CMappedFile()
+{
+    Close();
+}
+
+#ifdef _WIN32
+
+bool CMappedFile::Open(const string& name)
+{
+    Close();
+    HANDLE file = CreateFileA(name.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return false;
+    }
+    m_file = file;
+    m_size = (size_t)size.QuadPart;
+    if (m_size == 0) {
+        return true;
+    }
+    m_mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m_mapping) {
+        m_data = (const char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (!m_data) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void CMappedFile::Close()
+{
+    if (m_data) {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mapping) {
+        CloseHandle(m_mapping);
+    }
+    if (m_file) {
+        CloseHandle(m_file);
+    }
+    m_data = nullptr;
+    m_mapping = nullptr;
+    m_file = nullptr;
+    m_size = 0;
+}
+
+void CMappedFile::Prefetch(size_t offset, size_t len) const
+{
+    //FILE_FLAG_SEQUENTIAL_SCAN already makes the cache manager read ahead
+}
+
+#else //_WIN32
+
+bool CMappedFile::Open(const string& name)
+{
+    Close();
+    int fd = open(name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+    m_size = (size_t)st.st_size;
+    if (m_size) {
+        void* p = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            m_size = 0;
+            return false;
+        }
+        m_data = (const char*)p;
+        //the input is scanned once front to back
+        madvise(p, m_size, MADV_SEQUENTIAL);
+    }
+    //the mapping keeps the file referenced
+    close(fd);
+    LOGD("mapped %s, %zu bytes\n", name.c_str(), m_size);
+    return true;
+}
+
+void CMappedFile::Close()
+{
+    if (m_data) {
+        munmap((void*)m_data, m_size);
+    }
+    m_data = nullptr;
+    m_size = 0;
+}
+
+void CMappedFile::Prefetch(size_t offset, size_t len) const
+{
+    if (offset >= m_size) {
+        return;
+    }
+    if (len > m_size - offset) {
+        len = m_size - offset;
+    }
+    //madvise wants a page aligned start
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = offset & ~(page - 1);
+    madvise((void*)(m_data + start), len + (offset - start), MADV_WILLNEED);
+}
+
+#endif //_WIN32
@@ -0,0 +1,29 @@
+#pragma once
+#include <stddef.h>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+//Read-only memory mapping of a whole file.
+class CMappedFile
+{
+public:
+	CMappedFile() {}
+	CMappedFile(const CMappedFile&) = delete;
+	CMappedFile& operator=(const CMappedFile&) = delete;
+	~CMappedFile();
+	//fails for files that can't be mapped (pipes, character devices)
+	bool Open(const string& name);
+	void Close();
+	string_view View() const { return string_view(m_data, m_size); }
+	//hints the kernel to start reading [offset, offset + len) in the background
+	void Prefetch(size_t offset, size_t len) const;
+private:
+	const char* m_data = nullptr;
+	size_t m_size = 0;
+#ifdef _WIN32
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#endif //_WIN32
+};
@@ -0,0 +1,66 @@
+#include "CResultCache.h"
+#include "CLogger.h"
+
+#define IS_SPACE(x) (x  == ' ' || x  == '\t')
+#define IS_WORD(x) ((x >= '0' && x <= '9') || (x >= 'a' && x <= 'z') || (x >= 'A' && x <= 'Z') || x == '_' || x == '.')
+
+CResultCache::CResultCache(size_t capacity) : m_capacity(capacity)
+{
+    m_map.reserve(capacity);
+}
+
+void CResultCache::Normalize(string_view expr, string& key)
+{
+    key.clear();
+    bool space = false;
+    for (char c : expr) {
+        if (IS_SPACE(c)) {
+            space = true;
+            continue;
+        }
+        //"22+33 44" and "22+3344" must stay different keys
+        if (space && key.size() && IS_WORD(key.back()) && IS_WORD(c)) {
+            key += ' ';
+        }
+        space = false;
+        key += c;
+    }
+}
+
+bool CResultCache::Find(const string& key, double& result, int& err)
+{
+    auto it = m_map.find(key);
+    if (it == m_map.end()) {
+        m_stats.misses++;
+        return false;
+    }
+    m_stats.hits++;
+    //move the entry to the front, iterators stay valid
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+    result = it->second->result;
+    err = it->second->err;
+    return true;
+}
+
+void CResultCache::Insert(const string& key, double result, int err)
+{
+    if (m_capacity == 0 || m_map.count(key)) {
+        return;
+    }
+    if (m_map.size() >= m_capacity) {
+        //reuse the least recently used node for the new entry
+        auto last = prev(m_lru.end());
+        m_map.erase(last->key);
+        m_lru.splice(m_lru.begin(), m_lru, last);
+        m_stats.evictions++;
+        LOGD("evicted: %s\n", m_lru.front().key.c_str());
+    }
+    else {
+        m_lru.emplace_front();
+    }
+    SEntry& e = m_lru.front();
+    e.key = key;
+    e.result = result;
+    e.err = err;
+    m_map.emplace(e.key, m_lru.begin());
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <stdint.h>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+using namespace std;
+
+//Bounded LRU cache of expression results (or errors),
+//keyed on the whitespace-normalized expression text.
+class CResultCache
+{
+public:
+	struct SStats {
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+	};
+
+	CResultCache() = delete;
+	explicit CResultCache(size_t capacity);
+	~CResultCache() {}
+
+	//drops the spaces and tabs the tokenizer would skip,
+	//one space is kept between two number or name characters
+	static void Normalize(string_view expr, string& key);
+
+	bool Find(const string& key, double& result, int& err);
+	void Insert(const string& key, double result, int err);
+
+	size_t Size() const { return m_map.size(); }
+	size_t Capacity() const { return m_capacity; }
+	const SStats& Stats() const { return m_stats; }
+private:
+	struct SEntry {
+		string key;
+		double result;
+		int err;
+	};
+	size_t m_capacity;
+	list<SEntry> m_lru; //most recently used first
+	unordered_map<string_view, list<SEntry>::iterator> m_map;
+	SStats m_stats;
+};
@@ -0,0 +1,59 @@
+#include <stdint.h>
+
+#include "CScratchArena.h"
+#include "CLogger.h"
+
+CScratchArena& CScratchArena::Local()
+{
+    static thread_local CScratchArena arena;
+    return arena;
+}
+
+void* CScratchArena::Allocate(size_t size)
+{
+    size = (size + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1);
+    //released chunks after the current one are reused before a new one is added,
+    //a chunk too small for the request stays empty until the scope ends
+    while (m_current < m_chunks.size()) {
+        SChunk& c = m_chunks[m_current];
+        if (c.size - c.used >= size) {
+            void* p = c.data + c.used;
+            c.used += size;
+            return p;
+        }
+        if (m_current + 1 == m_chunks.size()) {
+            break;
+        }
+        m_chunks[++m_current].used = 0;
+    }
+    size_t chunk = m_chunks.empty() ? SCRATCH_CHUNK_SIZE : m_chunks.back().size * 2;
+    while (chunk < size) {
+        chunk *= 2;
+    }
+    SChunk c;
+    c.mem.reset(new char[chunk + SCRATCH_ALIGN - 1]);
+    c.data = (char*)(((uintptr_t)c.mem.get() + SCRATCH_ALIGN - 1) & ~(uintptr_t)(SCRATCH_ALIGN - 1));
+    c.size = chunk;
+    c.used = size;
+    m_chunks.push_back(move(c));
+    m_current = m_chunks.size() - 1;
+    LOGD("scratch arena chunk %zu bytes, %zu chunks\n", chunk, m_chunks.size());
+    return m_chunks.back().data;
+}
+
+void CScratchArena::Release(size_t chunk, size_t used)
+{
+    if (chunk < m_chunks.size()) {
+        m_current = chunk;
+        m_chunks[chunk].used = used;
+    }
+}
+
+size_t CScratchArena::Reserved() const
+{
+    size_t n = 0;
+    for (const SChunk& c : m_chunks) {
+        n += c.size;
+    }
+    return n;
+}
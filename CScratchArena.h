@@ -0,0 +1,59 @@
+#pragma once
+#include <stddef.h>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+//first chunk of every thread's arena, later chunks double
+#define SCRATCH_CHUNK_SIZE (256 * 1024)
+//alignment of every allocation, a cache line
+#define SCRATCH_ALIGN 64
+
+//Monotonic scratch memory of one thread for evaluation temporaries.
+//Allocation bumps a pointer and nothing is freed one by one: a CScope gives back
+//everything allocated since it was opened. Chunks are kept until the thread exits,
+//so once the arena has grown to the working set no evaluation reaches the heap.
+class CScratchArena
+{
+public:
+	//allocations made while it is alive are released by its destructor, scopes nest
+	class CScope
+	{
+	public:
+		CScope() : m_arena(CScratchArena::Local()), m_chunk(m_arena.m_current), m_used(m_arena.Used()) {}
+		CScope(const CScope&) = delete;
+		CScope& operator=(const CScope&) = delete;
+		~CScope() { m_arena.Release(m_chunk, m_used); }
+		CScratchArena& Arena() { return m_arena; }
+	private:
+		CScratchArena& m_arena;
+		size_t m_chunk;
+		size_t m_used;
+	};
+
+	CScratchArena(const CScratchArena&) = delete;
+	CScratchArena& operator=(const CScratchArena&) = delete;
+	~CScratchArena() {}
+	//arena of the calling thread
+	static CScratchArena& Local();
+	//uninitialized room for n objects of a trivial type
+	template <class T>
+	T* Alloc(size_t n) { return (T*)Allocate(n * sizeof(T)); }
+	void* Allocate(size_t size);
+	//bytes held by the arena
+	size_t Reserved() const;
+private:
+	struct SChunk {
+		unique_ptr<char[]> mem;
+		char* data; //mem aligned to SCRATCH_ALIGN
+		size_t size;
+		size_t used;
+	};
+	vector<SChunk> m_chunks;
+	size_t m_current = 0; //chunk allocations come from, the later ones are empty
+
+	CScratchArena() {}
+	size_t Used() const { return m_current < m_chunks.size() ? m_chunks[m_current].used : 0; }
+	void Release(size_t chunk, size_t used);
+};
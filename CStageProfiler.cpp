@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include "CStageProfiler.h"
+
+CStageProfiler::SThreadData& CStageProfiler::Local()
+{
+    thread_local SThreadData* data = nullptr;
+    if (!data) {
+        shared_ptr<SThreadData> d(new SThreadData());
+        lock_guard<mutex> lock(m_mutex);
+        m_threads.push_back(d);
+        data = d.get();
+    }
+    return *data;
+}
+
+void CStageProfiler::Record(PROFILE_STAGE stage, uint64_t ns)
+{
+    Local().stages[stage].Record(ns);
+}
+
+void CStageProfiler::RecordValue(PROFILE_VALUE value, uint64_t x)
+{
+    Local().values[value].Record(x);
+}
+
+void CStageProfiler::Merge(CHistogram stages[STAGE_COUNT], CHistogram values[VALUE_COUNT])
+{
+    lock_guard<mutex> lock(m_mutex);
+    for (auto& d : m_threads) {
+        for (int i = 0; i < STAGE_COUNT; i++) {
+            stages[i].Add(d->stages[i]);
+        }
+        for (int i = 0; i < VALUE_COUNT; i++) {
+            values[i].Add(d->values[i]);
+        }
+    }
+}
+
+void CStageProfiler::Reset()
+{
+    lock_guard<mutex> lock(m_mutex);
+    for (auto& d : m_threads) {
+        for (auto& h : d->stages) {
+            h.Reset();
+        }
+        for (auto& h : d->values) {
+            h.Reset();
+        }
+    }
+}
+
+static void ReportLine(string& out, const char* name, const CHistogram& h)
+{
+    char line[256];
+    uint64_t count = h.Count();
+    snprintf(line, sizeof(line), "%-18s %10llu %10llu %10llu %10llu %10llu %12.1f\n", name,
+        (unsigned long long)count, (unsigned long long)h.Percentile(0.5), (unsigned long long)h.Percentile(0.99),
+        (unsigned long long)h.Percentile(0.999), (unsigned long long)h.Max(),
+        count ? (double)h.Sum() / (double)count : 0.0);
+    out += line;
+}
+
+void CStageProfiler::Report(string& out)
+{
+    static const char* stages[STAGE_COUNT] = { "tokenize", "infix_to_postfix", "compile", "optimize", "evaluate", "total" };
+    static const char* values[VALUE_COUNT] = { "expr_length", "expr_tokens" };
+    unique_ptr<CHistogram[]> s(new CHistogram[STAGE_COUNT]);
+    unique_ptr<CHistogram[]> v(new CHistogram[VALUE_COUNT]);
+    Merge(s.get(), v.get());
+    char line[256];
+    snprintf(line, sizeof(line), "%-18s %10s %10s %10s %10s %10s %12s\n", "stage (ns)", "count", "p50", "p99", "p999", "max", "mean");
+    out += line;
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        ReportLine(out, stages[i], s[i]);
+    }
+    snprintf(line, sizeof(line), "%-18s %10s %10s %10s %10s %10s %12s\n", "expression", "count", "p50", "p99", "p999", "max", "mean");
+    out += line;
+    for (int i = 0; i < VALUE_COUNT; i++) {
+        ReportLine(out, values[i], v[i]);
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "CHistogram.h"
+
+using namespace std;
+
+//timed stages of CCalculator::Evaluate()
+enum PROFILE_STAGE {
+	STAGE_TOKENIZE,         //ParseStringToInfix() with GetToken()
+	STAGE_INFIX_TO_POSTFIX,
+	STAGE_COMPILE,          //PostfixToProgram()
+	STAGE_OPTIMIZE,         //CExprTree build, optimize and lower
+	STAGE_EVALUATE,         //running the program, the old PostfixEvaluate()
+	STAGE_TOTAL,            //the whole Evaluate() including the cache
+	STAGE_COUNT
+};
+
+//value distributions
+enum PROFILE_VALUE {
+	VALUE_EXPR_LENGTH,      //characters
+	VALUE_EXPR_TOKENS,
+	VALUE_COUNT
+};
+
+//Per stage latency histograms. Every thread records into its own histograms,
+//they are merged when a report is made. Off until Enable(true).
+class CStageProfiler
+{
+public:
+	static void Enable(bool enable) { m_enabled.store(enable, memory_order_relaxed); }
+	static bool Enabled() { return m_enabled.load(memory_order_relaxed); }
+
+	static void Record(PROFILE_STAGE stage, uint64_t ns);
+	static void RecordValue(PROFILE_VALUE value, uint64_t x);
+
+	//sums the histograms of every thread, live or finished
+	static void Merge(CHistogram stages[STAGE_COUNT], CHistogram values[VALUE_COUNT]);
+	//p50/p99/p999 per stage and value, one line each
+	static void Report(string& out);
+	static void Reset();
+private:
+	struct SThreadData {
+		CHistogram stages[STAGE_COUNT];
+		CHistogram values[VALUE_COUNT];
+	};
+	static SThreadData& Local();
+
+	inline static atomic<bool> m_enabled{ false };
+	//every thread's histograms, kept after the thread exits
+	inline static mutex m_mutex;
+	inline static vector<shared_ptr<SThreadData>> m_threads;
+};
+
+//records the lifetime of the scope for its stage
+class CStageTimer
+{
+public:
+	explicit CStageTimer(PROFILE_STAGE stage) : m_stage(stage), m_on(CStageProfiler::Enabled())
+	{
+		if (m_on) {
+			m_start = chrono::steady_clock::now();
+		}
+	}
+	~CStageTimer()
+	{
+		if (m_on) {
+			CStageProfiler::Record(m_stage,
+				chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - m_start).count());
+		}
+	}
+private:
+	PROFILE_STAGE m_stage;
+	bool m_on;
+	chrono::steady_clock::time_point m_start;
+};
+
+//compiled out without CALC_PROFILE
+#ifdef CALC_PROFILE
+#define PROFILE_SCOPE(stage) CStageTimer stage_timer_(stage)
+#define PROFILE_RECORD(value, x) if (CStageProfiler::Enabled()) CStageProfiler::RecordValue(value, x)
+#else
+#define PROFILE_SCOPE(stage)
+#define PROFILE_RECORD(value, x)
+#endif
@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif //_WIN32
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+#include "CSweep.h"
+#include "CScratchArena.h"
+#include "CThreadPool.h"
+#include "CLogger.h"
+
+struct CSweep::SChunk {
+    uint64_t first = 0;
+    size_t rows = 0;
+    string out;
+    SSweepStats stats;
+    bool done = false;
+};
+
+bool ParseSweepRange(const string& spec, SSweepRange& range)
+{
+    size_t eq = spec.find('=');
+    if (eq == string::npos || eq == 0) {
+        return false;
+    }
+    double v[3];
+    const char* p = spec.c_str() + eq + 1;
+    for (int i = 0; i < 3; i++) {
+        char* end;
+        v[i] = strtod(p, &end);
+        if (end == p || *end != (i < 2 ? ':' : '\0')) {
+            return false;
+        }
+        p = end + 1;
+    }
+    double steps = (v[1] - v[0]) / v[2];
+    if (!(v[2] != 0) || !(steps >= 0) || steps > 1e18) {
+        return false;
+    }
+    range.name = spec.substr(0, eq);
+    range.start = v[0];
+    range.step = v[2];
+    //0:1:0.1 has 11 points although (1 - 0) / 0.1 is a bit below 10
+    range.count = (uint64_t)floor(steps + 1e-9) + 1;
+    return true;
+}
+
+void SSweepStats::Merge(const SSweepStats& b)
+{
+    count += b.count;
+    sum += b.sum;
+    if (b.min < min) {
+        min = b.min;
+        argmin = b.argmin;
+    }
+    if (b.max > max) {
+        max = b.max;
+        argmax = b.argmax;
+    }
+}
+
+CSweep::CSweep(const SBatchOptions& options) :
+    m_threads(options.threads), m_output(options.output)
+{
+    if (m_threads == 0) {
+        m_threads = thread::hardware_concurrency();
+    }
+    if (m_threads == 0) {
+        m_threads = 1;
+    }
+    m_calc.SetOptimization(options.optimization);
+}
+
+int CSweep::Compile(string_view formula, const vector<SSweepRange>& ranges)
+{
+    int res = m_calc.Compile(formula, m_prog);
+    if (res != CALC_OK) {
+        return res;
+    }
+    m_ranges = ranges;
+    m_columns.clear();
+    for (auto& v : m_prog.Variables()) {
+        auto it = find_if(m_ranges.begin(), m_ranges.end(), [&v](const SSweepRange& r) { return r.name == v; });
+        if (it == m_ranges.end()) {
+            LOGE("no range for %s\n", v.c_str());
+            return CALC_ERR_VARIABLE;
+        }
+        m_columns.push_back((int)(it - m_ranges.begin()));
+    }
+    m_strides.assign(m_ranges.size(), 1);
+    m_points = 1;
+    for (size_t i = m_ranges.size(); i-- > 0;) {
+        m_strides[i] = m_points;
+        if (m_ranges[i].count > UINT64_MAX / m_points) {
+            LOGE("sweep grid has more than %llu points\n", (unsigned long long)UINT64_MAX);
+            return CALC_ERR_RANGE;
+        }
+        m_points *= m_ranges[i].count;
+    }
+    return CALC_OK;
+}
+
+void CSweep::Point(uint64_t point, vector<double>& values) const
+{
+    values.resize(m_ranges.size());
+    for (size_t i = 0; i < m_ranges.size(); i++) {
+        uint64_t idx = point / m_strides[i] % m_ranges[i].count;
+        values[i] = m_ranges[i].start + (double)idx * m_ranges[i].step;
+    }
+}
+
+void CSweep::Fill(size_t range, uint64_t first, size_t rows, double* column) const
+{
+    //a range keeps its value for stride points, then moves to the next one
+    const SSweepRange& r = m_ranges[range];
+    const uint64_t stride = m_strides[range];
+    uint64_t idx = first / stride % r.count;
+    uint64_t left = stride - first % stride;
+    size_t i = 0;
+    while (i < rows) {
+        double v = r.start + (double)idx * r.step;
+        size_t n = (size_t)min<uint64_t>(left, rows - i);
+        fill(column + i, column + i + n, v);
+        i += n;
+        left = stride;
+        if (++idx == r.count) {
+            idx = 0;
+        }
+    }
+}
+
+void CSweep::Evaluate(SChunk& chunk, bool reduce)
+{
+    const size_t rows = chunk.rows;
+    CScratchArena::CScope scratch;
+    double* columns = scratch.Arena().Alloc<double>(m_columns.size() * rows);
+    const double** ptrs = scratch.Arena().Alloc<const double*>(m_columns.size());
+    for (size_t i = 0; i < m_columns.size(); i++) {
+        ptrs[i] = columns + i * rows;
+        Fill(m_columns[i], chunk.first, rows, columns + i * rows);
+    }
+    double* results = scratch.Arena().Alloc<double>(rows);
+    m_prog.EvaluateColumns(ptrs, rows, results);
+    if (reduce) {
+        SSweepStats& s = chunk.stats;
+        s = SSweepStats();
+        s.count = rows;
+        for (size_t i = 0; i < rows; i++) {
+            double v = results[i];
+            s.sum += v;
+            if (v < s.min) {
+                s.min = v;
+                s.argmin = chunk.first + i;
+            }
+            if (v > s.max) {
+                s.max = v;
+                s.argmax = chunk.first + i;
+            }
+        }
+    }
+    else if (m_output == OUTPUT_FORMAT::Binary) {
+        AppendResultGroups(chunk.out, results, rows);
+    }
+    else {
+        char num[64];
+        chunk.out.reserve(rows * 24);
+        for (size_t i = 0; i < rows; i++) {
+            int len = FormatResult(num, sizeof(num) - 1, results[i]);
+            num[len++] = '\n';
+            chunk.out.append(num, len);
+        }
+    }
+}
+
+int CSweep::Run(bool reduce)
+{
+    if (!reduce && m_output == OUTPUT_FORMAT::Binary) {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif //_WIN32
+        fwrite(RESULT_BIN_MAGIC, 1, sizeof(RESULT_BIN_MAGIC) - 1, stdout);
+    }
+    m_stats = SSweepStats();
+    const uint64_t chunks = (m_points + SWEEP_CHUNK_ROWS - 1) / SWEEP_CHUNK_ROWS;
+    //chunks are finished in point order, so the sum does not depend on the thread count
+    auto finish = [this, reduce](SChunk& c) {
+        if (reduce) {
+            m_stats.Merge(c.stats);
+        }
+        else {
+            fwrite(c.out.data(), 1, c.out.size(), stdout);
+        }
+    };
+    auto next = [this](SChunk& c, uint64_t i) {
+        c.first = i * SWEEP_CHUNK_ROWS;
+        c.rows = (size_t)min<uint64_t>(SWEEP_CHUNK_ROWS, m_points - c.first);
+    };
+    if (m_threads == 1) {
+        SChunk c;
+        for (uint64_t i = 0; i < chunks; i++) {
+            next(c, i);
+            c.out.clear();
+            Evaluate(c, reduce);
+            finish(c);
+        }
+    }
+    else {
+        //the same window as CBatchProcessor::RunParallel()
+        CThreadPool pool(m_threads);
+        deque<unique_ptr<SChunk>> window;
+        vector<unique_ptr<SChunk>> spare; //finished chunks, reused with their output buffers
+        mutex m;
+        condition_variable cv;
+        auto finishFront = [&]() {
+            SChunk* c = window.front().get();
+            {
+                unique_lock lock(m);
+                cv.wait(lock, [c] { return c->done; });
+            }
+            finish(*c);
+            c->out.clear();
+            c->done = false;
+            spare.push_back(move(window.front()));
+            window.pop_front();
+        };
+        for (uint64_t i = 0; i < chunks; i++) {
+            if (spare.empty()) {
+                window.emplace_back(new SChunk);
+            }
+            else {
+                window.push_back(move(spare.back()));
+                spare.pop_back();
+            }
+            SChunk* c = window.back().get();
+            next(*c, i);
+            pool.Submit([this, c, reduce, &m, &cv]() {
+                Evaluate(*c, reduce);
+                {
+                    lock_guard lock(m);
+                    c->done = true;
+                }
+                cv.notify_all();
+            });
+            if (window.size() >= (size_t)m_threads * SWEEP_CHUNKS_PER_THREAD) {
+                finishFront();
+            }
+        }
+        while (window.size()) {
+            finishFront();
+        }
+    }
+    if (reduce) {
+        WriteStats();
+    }
+    fflush(stdout);
+    return 0;
+}
+
+void CSweep::WriteStats()
+{
+    char num[64];
+    string out = "points = " + to_string(m_stats.count) + "\n";
+    out += "sum = ";
+    out.append(num, FormatResult(num, sizeof(num), m_stats.sum));
+    out += "\nmean = ";
+    out.append(num, FormatResult(num, sizeof(num), m_stats.count ? m_stats.sum / m_stats.count : NAN));
+    vector<double> values;
+    const char* names[2] = { "min", "max" };
+    for (int i = 0; i < 2; i++) {
+        double v = i ? m_stats.max : m_stats.min;
+        out += "\n";
+        out += names[i];
+        out += " = ";
+        if (m_stats.min > m_stats.max) {
+            //every result was NaN
+            out += "nan";
+            continue;
+        }
+        out.append(num, FormatResult(num, sizeof(num), v));
+        out += " at";
+        Point(i ? m_stats.argmax : m_stats.argmin, values);
+        for (size_t r = 0; r < m_ranges.size(); r++) {
+            out += " " + m_ranges[r].name + "=";
+            out.append(num, FormatResult(num, sizeof(num), values[r]));
+        }
+    }
+    out += "\n";
+    fwrite(out.data(), 1, out.size(), stdout);
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <stdint.h>
+#include <math.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "CBatchProcessor.h"
+
+using namespace std;
+
+//rows of one task, a multiple of COLUMN_BLOCK_SIZE
+#define SWEEP_CHUNK_ROWS (64 * COLUMN_BLOCK_SIZE)
+//chunks in work per thread
+#define SWEEP_CHUNKS_PER_THREAD 4
+
+//values start, start + step, ... of one variable
+struct SSweepRange {
+	string name;
+	double start = 0;
+	double step = 1;
+	uint64_t count = 1;
+};
+
+//"name=start:stop:step", stop is included when a step lands on it
+bool ParseSweepRange(const string& spec, SSweepRange& range);
+
+//reduction of the results, NaN results are left out of min and max
+struct SSweepStats {
+	uint64_t count = 0;
+	double sum = 0;
+	double min = INFINITY;
+	double max = -INFINITY;
+	uint64_t argmin = 0; //point of min
+	uint64_t argmax = 0;
+	//b follows this in point order, the first point wins a tie
+	void Merge(const SSweepStats& b);
+};
+
+//One formula over the Cartesian product of ranges. The last range varies fastest.
+//The formula is compiled once and the points are evaluated in chunks by the thread
+//pool with the column kernels. The results are written in point order, or only reduced.
+class CSweep
+{
+public:
+	CSweep() = delete;
+	explicit CSweep(const SBatchOptions& options);
+	~CSweep() {}
+	//every variable of formula needs a range, CALC_ERR_VARIABLE otherwise
+	int Compile(string_view formula, const vector<SSweepRange>& ranges);
+	//writes the results to stdout, or the reduction when reduce is set
+	int Run(bool reduce);
+	uint64_t Points() const { return m_points; }
+	//value of every range at point
+	void Point(uint64_t point, vector<double>& values) const;
+	const SSweepStats& Stats() const { return m_stats; }
+private:
+	struct SChunk;
+	unsigned int m_threads;
+	OUTPUT_FORMAT m_output;
+	CCalculator m_calc;
+	CCompiledExpression m_prog;
+	vector<SSweepRange> m_ranges;
+	vector<uint64_t> m_strides; //points between two values of a range
+	vector<int> m_columns;      //range of every program variable
+	uint64_t m_points = 0;
+	SSweepStats m_stats;
+
+	void Evaluate(SChunk& chunk, bool reduce);
+	//values of range for points first .. first + rows
+	void Fill(size_t range, uint64_t first, size_t rows, double* column) const;
+	void WriteStats();
+};
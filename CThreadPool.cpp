@@ -0,0 +1,105 @@
+#include "CThreadPool.h"
+#include "CLogger.h"
+
+static thread_local int worker_index = -1;
+
+CThreadPool::CThreadPool(unsigned int threads)
+{
+    if (threads == 0) {
+        threads = 1;
+    }
+    for (unsigned int i = 0; i < threads; i++) {
+        m_queues.emplace_back(new SWorkerQueue);
+    }
+    for (unsigned int i = 0; i < threads; i++) {
+        m_threads.emplace_back(&CThreadPool::WorkerLoop, this, i);
+    }
+    LOGD("started %d workers\n", threads);
+}
+
+CThreadPool::~CThreadPool()
+{
+    {
+        lock_guard lock(m_mutex);
+        m_stop = true;
+    }
+    m_work_cv.notify_all();
+    for (auto& t : m_threads) {
+        t.join();
+    }
+}
+
+int CThreadPool::WorkerIndex()
+{
+    return worker_index;
+}
+
+void CThreadPool::Submit(function<void()> task)
+{
+    //tasks submitted by a worker stay on its own deque, others are spread round-robin
+    unsigned int idx = worker_index >= 0 ? (unsigned int)worker_index : m_next++ % Size();
+    m_pending++;
+    {
+        lock_guard lock(m_queues[idx]->m);
+        m_queues[idx]->tasks.push_back(move(task));
+    }
+    {
+        lock_guard lock(m_mutex);
+        m_queued++;
+    }
+    m_work_cv.notify_one();
+}
+
+void CThreadPool::Wait()
+{
+    unique_lock lock(m_mutex);
+    m_done_cv.wait(lock, [this] { return m_pending == 0; });
+}
+
+bool CThreadPool::Pop(unsigned int idx, function<void()>& task)
+{
+    //own deque first, newest task is the most cache-friendly one
+    {
+        SWorkerQueue& q = *m_queues[idx];
+        lock_guard lock(q.m);
+        if (q.tasks.size()) {
+            task = move(q.tasks.back());
+            q.tasks.pop_back();
+            return true;
+        }
+    }
+    //then steal the oldest task of another worker
+    for (unsigned int i = 1; i < Size(); i++) {
+        SWorkerQueue& q = *m_queues[(idx + i) % Size()];
+        lock_guard lock(q.m);
+        if (q.tasks.size()) {
+            task = move(q.tasks.front());
+            q.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void CThreadPool::WorkerLoop(unsigned int idx)
+{
+    worker_index = (int)idx;
+    function<void()> task;
+    while (1) {
+        if (Pop(idx, task)) {
+            m_queued--;
+            task();
+            task = nullptr;
+            if (--m_pending == 0) {
+                lock_guard lock(m_mutex);
+                m_done_cv.notify_all();
+            }
+            continue;
+        }
+        unique_lock lock(m_mutex);
+        m_work_cv.wait(lock, [this] { return m_stop || m_queued > 0; });
+        if (m_stop && m_queued == 0) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+//Work-stealing thread pool.
+//Every worker owns a task deque: it takes its own tasks from the back
+//and steals from the front of the other workers' deques when it runs dry.
+class CThreadPool
+{
+public:
+	CThreadPool() = delete;
+	CThreadPool(const CThreadPool&) = delete;
+	CThreadPool& operator=(const CThreadPool&) = delete;
+	explicit CThreadPool(unsigned int threads);
+	~CThreadPool();
+
+	void Submit(function<void()> task);
+	//blocks until every submitted task has finished
+	void Wait();
+	unsigned int Size() const { return (unsigned int)m_threads.size(); }
+	//index of the pool worker running the caller, -1 for other threads
+	static int WorkerIndex();
+private:
+	struct SWorkerQueue {
+		mutex m;
+		deque<function<void()>> tasks;
+	};
+	vector<unique_ptr<SWorkerQueue>> m_queues;
+	vector<thread> m_threads;
+	atomic<unsigned int> m_next{ 0 };
+	atomic<size_t> m_queued{ 0 };  //tasks waiting in the queues
+	atomic<size_t> m_pending{ 0 }; //tasks not finished yet
+	mutex m_mutex;
+	condition_variable m_work_cv;
+	condition_variable m_done_cv;
+	bool m_stop = false;
+
+	void WorkerLoop(unsigned int idx);
+	bool Pop(unsigned int idx, function<void()>& task);
+};
@@ -0,0 +1,171 @@
+#include <cmath>
+
+#include "CThreadedProgram.h"
+#include "CColumnKernels.h"
+#include "CScratchArena.h"
+#include "CLogger.h"
+
+#if defined(__GNUC__)
+#define THREADED_COMPUTED_GOTO
+#endif
+
+//X(name, body): body works on ip (current op), sp (top of the stack) and vars
+#define THREADED_OPS(X) \
+    X(Push, *++sp = ip->val;) \
+    X(Var,  *++sp = vars[ip->idx];) \
+    X(Dup,  sp[1] = sp[0]; sp++;) \
+    X(Sqrt, sp[0] = sqrt(sp[0]);) \
+    X(Abs,  sp[0] = fabs(sp[0]);) \
+    X(Exp,  sp[0] = exp(sp[0]);) \
+    X(Log,  sp[0] = log(sp[0]);) \
+    X(Sin,  sp[0] = sin(sp[0]);) \
+    X(Cos,  sp[0] = cos(sp[0]);) \
+    X(Add,  sp[-1] = sp[-1] + sp[0]; sp--;) \
+    X(Sub,  sp[-1] = sp[-1] - sp[0]; sp--;) \
+    X(Mul,  sp[-1] = sp[-1] * sp[0]; sp--;) \
+    X(Div,  sp[-1] = sp[-1] / sp[0]; sp--;) \
+    X(Pow,  sp[-1] = pow(sp[-1], sp[0]); sp--;) \
+    X(Min,  sp[-1] = MinOf(sp[-1], sp[0]); sp--;) \
+    X(Max,  sp[-1] = MaxOf(sp[-1], sp[0]); sp--;) \
+    X(AddK, sp[0] = sp[0] + ip->val;) \
+    X(SubK, sp[0] = sp[0] - ip->val;) \
+    X(MulK, sp[0] = sp[0] * ip->val;) \
+    X(DivK, sp[0] = sp[0] / ip->val;) \
+    X(PowK, sp[0] = pow(sp[0], ip->val);) \
+    X(MinK, sp[0] = MinOf(sp[0], ip->val);) \
+    X(MaxK, sp[0] = MaxOf(sp[0], ip->val);) \
+    X(AddV, sp[0] = sp[0] + vars[ip->idx];) \
+    X(SubV, sp[0] = sp[0] - vars[ip->idx];) \
+    X(MulV, sp[0] = sp[0] * vars[ip->idx];) \
+    X(DivV, sp[0] = sp[0] / vars[ip->idx];) \
+    X(PowV, sp[0] = pow(sp[0], vars[ip->idx]);) \
+    X(MinV, sp[0] = MinOf(sp[0], vars[ip->idx]);) \
+    X(MaxV, sp[0] = MaxOf(sp[0], vars[ip->idx]);) \
+    X(ExpF, sp[0] = FastExp(sp[0]);) \
+    X(LogF, sp[0] = FastLog(sp[0]);) \
+    X(SinF, sp[0] = FastSin(sp[0]);) \
+    X(CosF, sp[0] = FastCos(sp[0]);)
+
+enum THREADED_OP {
+#define THREADED_ENUM(name, body) TOP_##name,
+    THREADED_OPS(THREADED_ENUM)
+#undef THREADED_ENUM
+    TOP_End
+};
+
+typedef CThreadedProgram::SOp SOp;
+
+#ifdef THREADED_COMPUTED_GOTO
+
+//handler addresses are labels local to Run(),
+//Run(nullptr, ...) stores them here once, under the initialization of Handler()'s table
+static const void* const* handlers = nullptr;
+
+static double Run(const SOp* ip, double* sp, const double* vars)
+{
+    static const void* const labels[] = {
+#define THREADED_LABEL(name, body) &&op_##name,
+        THREADED_OPS(THREADED_LABEL)
+#undef THREADED_LABEL
+        &&op_End
+    };
+    if (!ip) {
+        handlers = labels;
+        return 0;
+    }
+    sp--;
+    goto *ip->handler;
+#define THREADED_HANDLER(name, body) op_##name: body goto *(++ip)->handler;
+    THREADED_OPS(THREADED_HANDLER)
+#undef THREADED_HANDLER
+op_End:
+    return *sp;
+}
+
+static const void* Handler(THREADED_OP op)
+{
+    //a function local static is initialized once even when several workers compile
+    static const void* const* table = (Run(nullptr, nullptr, nullptr), handlers);
+    return table[op];
+}
+
+#else //THREADED_COMPUTED_GOTO
+
+typedef double* (*HandlerFn)(const SOp* ip, double* sp, const double* vars);
+
+#define THREADED_FUNCTION(name, body) \
+static double* op_##name(const SOp* ip, double* sp, const double* vars) { body return sp; }
+THREADED_OPS(THREADED_FUNCTION)
+#undef THREADED_FUNCTION
+
+static const HandlerFn functions[] = {
+#define THREADED_POINTER(name, body) op_##name,
+    THREADED_OPS(THREADED_POINTER)
+#undef THREADED_POINTER
+    nullptr
+};
+
+static double Run(const SOp* ip, double* sp, const double* vars)
+{
+    sp--;
+    for (; ip->handler; ip++) {
+        sp = ((HandlerFn)ip->handler)(ip, sp, vars);
+    }
+    return *sp;
+}
+
+static const void* Handler(THREADED_OP op)
+{
+    return (const void*)functions[op];
+}
+
+#endif //THREADED_COMPUTED_GOTO
+
+void CThreadedProgram::Compile(const CCompiledExpression& prog)
+{
+    m_ops.clear();
+    m_depth = prog.m_depth;
+    const vector<SInstruction>& code = prog.m_code;
+    for (size_t i = 0; i < code.size(); i++) {
+        const SInstruction& in = code[i];
+        SOp op;
+        op.val = 0;
+        //operand followed by a binary operation, fuse them
+        bool fuse = (in.op == OPCODE::Push || in.op == OPCODE::Var)
+            && i + 1 < code.size() && code[i + 1].op >= OPCODE::Add;
+        if (in.op == OPCODE::Push) {
+            op.val = prog.m_consts[in.arg];
+        }
+        else if (in.op == OPCODE::Var) {
+            op.idx = in.arg;
+        }
+        int top;
+        if (fuse) {
+            int base = in.op == OPCODE::Push ? TOP_AddK : TOP_AddV;
+            top = base + (int)code[++i].op - (int)OPCODE::Add;
+        }
+        else if (prog.m_fast && in.op >= OPCODE::Exp && in.op <= OPCODE::Cos) {
+            top = TOP_ExpF + (int)in.op - (int)OPCODE::Exp;
+        }
+        else {
+            top = TOP_Push + (int)in.op - (int)OPCODE::Push;
+        }
+        op.handler = Handler((THREADED_OP)top);
+        m_ops.push_back(op);
+    }
+    SOp end;
+    end.handler = Handler(TOP_End);
+    end.val = 0;
+    m_ops.push_back(end);
+    LOGD("threaded program size=%d\n", (int)m_ops.size());
+}
+
+double CThreadedProgram::Evaluate(const double* vars) const
+{
+    double stack[COMPILED_STACK_SIZE];
+    if (m_depth > COMPILED_STACK_SIZE) {
+        CScratchArena::CScope scratch;
+        return Run(m_ops.data(), scratch.Arena().Alloc<double>(m_depth), vars);
+    }
+    return Run(m_ops.data(), stack, vars);
+}
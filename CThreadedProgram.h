@@ -0,0 +1,38 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+
+#include "CCompiledExpression.h"
+
+using namespace std;
+
+enum class BACKEND {
+	Interpreter, //CCompiledExpression::Evaluate(), a switch per instruction
+	Threaded     //CThreadedProgram, every handler jumps straight to the next one
+};
+
+//Direct-threaded form of a compiled program.
+//Every instruction holds the address of its handler and its operand inline;
+//a constant or variable operand followed by a binary operation is fused
+//into one instruction. With GCC and Clang the handlers are labels of one
+//function chained by computed goto, elsewhere they are pre-bound functions.
+class CThreadedProgram
+{
+public:
+	struct SOp {
+		const void* handler;
+		union {
+			double val;
+			uint32_t idx;
+		};
+	};
+
+	CThreadedProgram() {}
+	~CThreadedProgram() {}
+	void Compile(const CCompiledExpression& prog);
+	double Evaluate(const double* vars = nullptr) const;
+	size_t Size() const { return m_ops.size(); }
+private:
+	vector<SOp> m_ops;
+	unsigned int m_depth = 0;
+};
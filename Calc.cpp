@@ -3,7 +3,13 @@
 #include <iostream>
 #include <string>
 #include <string.h>
+#include <stdlib.h>
 #include "CCalculator.h"
+#include "CBatchProcessor.h"
+#include "CCalcServer.h"
+#include "CCalcSession.h"
+#include "CSweep.h"
+#include "CStageProfiler.h"
 #include "CLogger.h"
 
 #ifdef _WIN32
@@ -29,18 +35,168 @@ CColorConsole colCons;
 
 int main(int argc, char* argv[], char* envp[])
 {
+	//the server reads SIGTERM and SIGINT from a signalfd: they are blocked before
+	//--log-async or --log-metrics start a thread, so every thread inherits the mask
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--serve") || !strcmp(argv[i], "--port")) {
+			CCalcServer::BlockSignals();
+			break;
+		}
+	}
 	LOG_INIT_COLORCONSOLE;
 
 	bool test = false;
-	if (argc == 2) {
-		string arg(argv[1]);
+	bool stats = false;
+	string batch;
+	string sheet;
+	string sweep;
+	vector<SSweepRange> ranges;
+	bool reduce = false;
+	SBatchOptions options;
+	SServerOptions server;
+	bool serve = false;
+	for (int i = 1; i < argc; i++) {
+		string arg(argv[i]);
 		if (arg == "-t") {
 			test = true;
 		}
+		else if (arg == "--batch" && i + 1 < argc) {
+			batch = argv[++i];
+		}
+		else if (arg == "--sheet" && i + 1 < argc) {
+			//"name = expression" cells, see CCalcSession
+			sheet = argv[++i];
+		}
+		else if (arg == "--sweep" && i + 1 < argc) {
+			//formula over the --range grid, e.g. --sweep "x^2 - y" --range x=0:1e8:1 --range y=1:3:1
+			sweep = argv[++i];
+		}
+		else if (arg == "--range" && i + 1 < argc && ParseSweepRange(argv[i + 1], ranges.emplace_back())) {
+			i++;
+		}
+		else if (arg == "--reduce") {
+			reduce = true;
+		}
+		else if (arg == "--cache" && i + 1 < argc) {
+			options.cache = strtoul(argv[++i], nullptr, 10);
+		}
+		else if (arg == "-j" && i + 1 < argc) {
+			options.threads = strtoul(argv[++i], nullptr, 10);
+		}
+		else if (arg == "-O0") {
+			options.optimization = OPT_NONE;
+		}
+		else if (arg == "--fast-math") {
+			options.optimization |= OPT_RECIPROCAL | OPT_FAST_MATH | OPT_POWI;
+		}
+		else if (arg == "--dump") {
+			options.dump = true;
+		}
+		else if (arg == "--output" && i + 1 < argc && string(argv[i + 1]) == "binary") {
+			options.output = OUTPUT_FORMAT::Binary;
+			i++;
+		}
+		else if (arg == "--output" && i + 1 < argc && string(argv[i + 1]) == "text") {
+			options.output = OUTPUT_FORMAT::Text;
+			i++;
+		}
+		else if (arg == "--serve" && i + 1 < argc) {
+			//Unix domain socket path, "-" to listen on --port only
+			server.socket = argv[++i];
+			if (server.socket == "-") {
+				server.socket.clear();
+			}
+			serve = true;
+		}
+		else if (arg == "--port" && i + 1 < argc) {
+			server.port = strtoul(argv[++i], nullptr, 10);
+			serve = true;
+		}
+		else if (arg == "--stats") {
+			stats = true;
+		}
+#ifdef CALC_LOGGING
+		else if (arg == "--log-async" && i + 1 < argc) {
+			string policy(argv[++i]);
+			LogInitAsync(policy == "drop" ? LOG_OVERFLOW::DROP
+				: policy == "overwrite" ? LOG_OVERFLOW::OVERWRITE : LOG_OVERFLOW::BLOCK);
+		}
+		else if (arg == "--log-binary" && i + 1 < argc) {
+			//decode with calc_logdecode
+			LogInitBinaryFile(argv[++i]);
+		}
+		else if (arg == "--log-metrics" && i + 1 < argc) {
+			//logger counters and latency, rewritten every second
+			CLogger::GetInstance().SetMetricsFile(argv[++i]);
+		}
+		else if (arg == "--log-sites" && i + 1 < argc) {
+			//e.g. "CCalculator::InfixToPostfix" or "-CThreadPool.cpp"
+			LogInitSites(argv[++i]);
+		}
+#endif //CALC_LOGGING
+		else if (arg == "--backend" && i + 1 < argc && string(argv[i + 1]) == "threaded") {
+			options.backend = BACKEND::Threaded;
+			i++;
+		}
+		else if (arg == "--backend" && i + 1 < argc && string(argv[i + 1]) == "interp") {
+			options.backend = BACKEND::Interpreter;
+			i++;
+		}
+		else {
+			cerr << "Usage: " << argv[0] << " [-t] [--batch <file|->] [--sheet <file|->]"
+				" [--sweep <formula> --range <name=start:stop:step>... [--reduce]] [-j <threads>] [--cache <entries>]"
+				" [-O0] [--fast-math] [--dump] [--stats] [--backend interp|threaded] [--output text|binary]"
+				" [--serve <socket|->] [--port <n>]" << endl;
+			return -1;
+		}
+	}
+
+	if (stats) {
+#ifdef CALC_PROFILE
+		CStageProfiler::Enable(true);
+#else
+		cerr << "stage statistics are not compiled in (CALC_PROFILE)" << endl;
+#endif
 	}
 
-	CCalculator* c = new CCalculator;
-	int res = c->Run(test);
-	delete c;
+	int res;
+	if (serve) {
+		CCalcServer s(server, options);
+		res = s.Run();
+	}
+	else if (sweep.size()) {
+		CSweep s(options);
+		res = s.Compile(sweep, ranges);
+		if (res != CALC_OK) {
+			cerr << "error: " << CalcErrorString(res) << endl;
+		}
+		else {
+			res = s.Run(reduce);
+		}
+	}
+	else if (sheet.size()) {
+		CCalcSession s;
+		s.Engine().SetOptimization(options.optimization);
+		res = s.Run(sheet);
+	}
+	else if (batch.size()) {
+		CBatchProcessor b(options);
+		res = b.Run(batch);
+	}
+	else {
+		CCalculator* c = new CCalculator;
+		c->SetCache(options.cache);
+		c->SetOptimization(options.optimization);
+		c->SetDump(options.dump);
+		c->SetBackend(options.backend);
+		res = c->Run(test);
+		delete c;
+	}
+
+	if (CStageProfiler::Enabled()) {
+		string report;
+		CStageProfiler::Report(report);
+		cerr << report;
+	}
 	return res;
 }
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+using namespace std;
+
+//how full a queue was, sampled on every push
+struct SQueueStats {
+    uint64_t pushes = 0;
+    uint64_t depth_sum = 0;   //depth after each push, divide by pushes for the mean
+    size_t max_depth = 0;
+    uint64_t full_waits = 0;  //pushes that found the queue full: the consumer is the slower stage
+    uint64_t empty_waits = 0; //pops that found the queue empty: the producer is the slower stage
+};
+
+//Bounded FIFO between two pipeline stages. Push blocks while the queue is full,
+//Pop blocks while it is empty. After Close the remaining items are still popped,
+//then Pop returns false.
+template < typename T >
+class TBlockingQueue {
+public:
+    explicit TBlockingQueue(size_t capacity) : m_capacity(capacity ? capacity : 1) {}
+
+    TBlockingQueue(const TBlockingQueue&) = delete;
+    TBlockingQueue& operator= (const TBlockingQueue&) = delete;
+
+    //false if the queue was closed, the item is dropped
+    bool Push(T&& item) {
+        unique_lock lock(m_mutex);
+        if (m_items.size() >= m_capacity) {
+            m_stats.full_waits++;
+            m_notFull.wait(lock, [this] { return m_items.size() < m_capacity || m_closed; });
+        }
+        if (m_closed) {
+            return false;
+        }
+        m_items.push_back(move(item));
+        m_stats.pushes++;
+        m_stats.depth_sum += m_items.size();
+        if (m_items.size() > m_stats.max_depth) {
+            m_stats.max_depth = m_items.size();
+        }
+        lock.unlock();
+        m_notEmpty.notify_one();
+        return true;
+    }
+
+    //false once the queue is closed and empty
+    bool Pop(T& item) {
+        unique_lock lock(m_mutex);
+        if (m_items.empty() && !m_closed) {
+            m_stats.empty_waits++;
+            m_notEmpty.wait(lock, [this] { return m_items.size() || m_closed; });
+        }
+        if (m_items.empty()) {
+            return false;
+        }
+        item = move(m_items.front());
+        m_items.pop_front();
+        lock.unlock();
+        m_notFull.notify_one();
+        return true;
+    }
+
+    //no more pushes, wakes every waiting thread
+    void Close() {
+        {
+            lock_guard lock(m_mutex);
+            m_closed = true;
+        }
+        m_notFull.notify_all();
+        m_notEmpty.notify_all();
+    }
+
+    size_t Capacity() const { return m_capacity; }
+    SQueueStats Stats() {
+        lock_guard lock(m_mutex);
+        return m_stats;
+    }
+
+private:
+    size_t m_capacity;
+    deque<T> m_items;
+    bool m_closed = false;
+    SQueueStats m_stats;
+    mutex m_mutex;
+    condition_variable m_notFull;
+    condition_variable m_notEmpty;
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+
+using namespace std;
+
+//Bounded lock-free queue of T slots (D. Vyukov's bounded MPMC queue).
+//Slots are filled and drained in place: Claim a slot, fill it, Publish it;
+//Take a slot, read it, Release it. Any number of threads may push and pop.
+template < typename T >
+class TRingBuffer {
+public:
+    //capacity is rounded up to a power of two
+    explicit TRingBuffer(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        m_mask = size - 1;
+        m_cells.reset(new SCell[size]);
+        for (size_t i = 0; i < size; i++) {
+            m_cells[i].seq.store(i, memory_order_relaxed);
+        }
+    }
+
+    TRingBuffer(const TRingBuffer&) = delete;
+    TRingBuffer& operator= (const TRingBuffer&) = delete;
+
+    size_t Capacity() const { return m_mask + 1; }
+    size_t Size() const {
+        size_t head = m_head.load(memory_order_relaxed);
+        size_t tail = m_tail.load(memory_order_relaxed);
+        return head >= tail ? head - tail : 0;
+    }
+
+    //free slot to fill, nullptr when the queue is full
+    T* Claim() {
+        size_t pos = m_head.load(memory_order_relaxed);
+        while (1) {
+            SCell& cell = m_cells[pos & m_mask];
+            size_t seq = cell.seq.load(memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                if (m_head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    cell.pos = pos;
+                    return &cell.data;
+                }
+            }
+            else if (dif < 0) {
+                return nullptr;
+            }
+            else {
+                pos = m_head.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    //makes a claimed slot visible to the consumers
+    void Publish(T* data) {
+        SCell* cell = CellOf(data);
+        cell->seq.store(cell->pos + 1, memory_order_release);
+    }
+
+    //oldest published slot, nullptr when the queue is empty
+    T* Take() {
+        size_t pos = m_tail.load(memory_order_relaxed);
+        while (1) {
+            SCell& cell = m_cells[pos & m_mask];
+            size_t seq = cell.seq.load(memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0) {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    cell.pos = pos;
+                    return &cell.data;
+                }
+            }
+            else if (dif < 0) {
+                return nullptr;
+            }
+            else {
+                pos = m_tail.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    //gives a taken slot back to the producers
+    void Release(T* data) {
+        SCell* cell = CellOf(data);
+        cell->seq.store(cell->pos + m_mask + 1, memory_order_release);
+    }
+
+private:
+    struct SCell {
+        T data; //first member, CellOf() relies on it
+        atomic<size_t> seq;
+        size_t pos;
+    };
+
+    static SCell* CellOf(T* data) {
+        return reinterpret_cast<SCell*>(data);
+    }
+
+    unique_ptr<SCell[]> m_cells;
+    size_t m_mask;
+    alignas(64) atomic<size_t> m_head{ 0 };
+    alignas(64) atomic<size_t> m_tail{ 0 };
+};
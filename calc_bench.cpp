@@ -0,0 +1,554 @@
+// calc_bench.cpp : micro-benchmarks of every pipeline stage and macro-benchmarks
+// on generated workloads. Results are written as JSON.
+//
+// calc_bench [--filter <substring>] [--min-time <seconds>] [--out <file>]
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "CCalculator.h"
+#include "CCalcSession.h"
+#include "CColumnKernels.h"
+#include "CAllocCounter.h"
+#include "CStageProfiler.h"
+#include "CLogger.h"
+
+using namespace std;
+
+struct SBenchResult {
+    string name;
+    uint64_t iterations;
+    double ns_per_op;
+    double allocs_per_op;
+    string error; //the case was not run, its input does not compile
+};
+
+//deterministic workload generator, the same input on every run
+class CWorkload
+{
+public:
+    CWorkload() {}
+    uint32_t Next()
+    {
+        m_state = m_state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (uint32_t)(m_state >> 33);
+    }
+    //short formula, 2..12 operations
+    string Formula()
+    {
+        static const char ops[] = "+-*/";
+        string e = to_string(Next() % 99 + 1);
+        unsigned int n = Next() % 11 + 2;
+        for (unsigned int i = 0; i < n; i++) {
+            e += ' ';
+            e += ops[Next() % 4];
+            e += ' ';
+            e += to_string(Next() % 999 + 1);
+        }
+        return e;
+    }
+    string Lines(unsigned int count)
+    {
+        string text;
+        for (unsigned int i = 0; i < count; i++) {
+            text += Formula();
+            text += '\n';
+        }
+        return text;
+    }
+    //(((...(1 + 1) * 2 ...) - 3) of the given nesting depth
+    string Nested(unsigned int depth)
+    {
+        static const char ops[] = "+-*";
+        string e(depth, '(');
+        e += "1";
+        for (unsigned int i = 0; i < depth; i++) {
+            e += ' ';
+            e += ops[i % 3];
+            e += ' ';
+            e += to_string(i % 7 + 1);
+            e += ')';
+        }
+        return e;
+    }
+    //flat expression of about tokens tokens
+    string Long(unsigned int tokens)
+    {
+        static const char ops[] = "+-*/";
+        string e = "1";
+        for (unsigned int i = 1; i + 1 < tokens; i += 2) {
+            e += ops[Next() % 4];
+            e += to_string(Next() % 9 + 1);
+        }
+        return e;
+    }
+private:
+    uint64_t m_state = 0x853c49e6748fea9bULL;
+};
+
+//discards the formatted records, only the formatting cost is measured
+class CNullWriter : public CLogWriter {
+public:
+    CNullWriter() : CLogWriter() {}
+    virtual ~CNullWriter() {}
+    void Write(const char* /*buff*/, const int len) override { m_bytes += len; }
+    void Write(const string& sMessage) override { m_bytes += sMessage.size(); }
+    bool Binary() const override { return true; }
+    uint64_t m_bytes = 0;
+};
+
+class CCalcBench
+{
+public:
+    CCalcBench(const string& filter, double min_time) : m_filter(filter), m_min_time(min_time) {}
+    void RunAll();
+    void WriteJson(FILE* f);
+    unsigned int Errors() const { return m_errors; }
+private:
+    string m_filter;
+    double m_min_time;
+    vector<SBenchResult> m_results;
+    unsigned int m_errors = 0;
+    CWorkload m_gen;
+
+    //body runs one batch of ops operations; check is the result of running its input
+    //once, a case whose input fails is reported with an error instead of a time
+    void Bench(const string& name, uint64_t ops, const function<void()>& body, int check = CALC_OK);
+    //first error of compiling every line of text
+    static int CheckLines(CCalculator& calc, const string& text);
+    void Micro();
+    void Macro();
+    void Session();
+    void Kernels();
+    void Logger();
+};
+
+//keeps results alive so the optimizer can't drop the measured work
+static volatile double sink;
+
+void CCalcBench::Bench(const string& name, uint64_t ops, const function<void()>& body, int check)
+{
+    if (m_filter.size() && name.find(m_filter) == string::npos) {
+        return;
+    }
+    if (check != CALC_OK) {
+        //a failing input returns early and would look very fast
+        SBenchResult r = { name, 0, 0, 0, CalcErrorString(check) };
+        m_results.push_back(r);
+        m_errors++;
+        cerr << name << ": error: " << r.error << endl;
+        return;
+    }
+    typedef chrono::steady_clock clock;
+    body(); //warm up caches and buffers
+    uint64_t reps = 1;
+    double elapsed = 0;
+    uint64_t allocs = 0;
+    //grow the repetition count until one measurement lasts m_min_time
+    while (1) {
+        uint64_t a0 = CAllocCounter::Get();
+        auto t0 = clock::now();
+        for (uint64_t i = 0; i < reps; i++) {
+            body();
+        }
+        elapsed = chrono::duration<double>(clock::now() - t0).count();
+        allocs = CAllocCounter::Get() - a0;
+        if (elapsed >= m_min_time || reps >= (1ULL << 40)) {
+            break;
+        }
+        double scale = elapsed > 0 ? m_min_time / elapsed * 1.2 : 10;
+        reps = (uint64_t)(reps * (scale < 10 ? (scale > 1.5 ? scale : 1.5) : 10)) + 1;
+    }
+    SBenchResult r;
+    r.name = name;
+    r.iterations = reps * ops;
+    r.ns_per_op = elapsed * 1e9 / (double)r.iterations;
+    r.allocs_per_op = (double)allocs / (double)r.iterations;
+    m_results.push_back(r);
+    cerr << name << ": " << r.ns_per_op << " ns/op" << endl;
+}
+
+int CCalcBench::CheckLines(CCalculator& calc, const string& text)
+{
+    CCompiledExpression prog;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        if (end == string::npos) {
+            end = text.size();
+        }
+        int res = calc.Compile(string_view(text).substr(pos, end - pos), prog);
+        if (res != CALC_OK) {
+            return res;
+        }
+        pos = end + 1;
+    }
+    return CALC_OK;
+}
+
+void CCalcBench::Micro()
+{
+    const string expr = "3 + 4 * 2 / (1 - 5) ^ 2 ^ 3";
+    CCalculator calc;
+    CCalculator::CToken token;
+
+    //tokens of expr
+    uint64_t tokens = 0;
+    for (unsigned int pos = 0; (pos = calc.GetToken(expr, pos, false, token)) > 0;) {
+        tokens++;
+    }
+    Bench("micro/GetToken", tokens, [&]() {
+        for (unsigned int pos = 0; (pos = calc.GetToken(expr, pos, false, token)) > 0;) {
+        }
+    });
+    int res = calc.ParseStringToInfix(expr, 0, (unsigned int)expr.size());
+    Bench("micro/ParseStringToInfix", 1, [&]() {
+        calc.ParseStringToInfix(expr, 0, (unsigned int)expr.size());
+    }, res);
+    //the later stages run on the streams of the last parse
+    res = calc.ParseStringToInfix(expr, 0, (unsigned int)expr.size());
+    Bench("micro/InfixToPostfix", 1, [&]() {
+        calc.InfixToPostfix();
+    }, res);
+    CCompiledExpression prog;
+    Bench("micro/PostfixToProgram", 1, [&]() {
+        calc.PostfixToProgram(prog);
+    }, res);
+    Bench("micro/CExprTree::Optimize", 1, [&]() {
+        calc.PostfixToProgram(prog);
+        calc.tree.Build(prog);
+        calc.tree.Optimize(OPT_DEFAULT);
+        calc.tree.Lower(prog);
+    }, res);
+
+    //evaluation stage of the old PostfixEvaluate(), per backend
+    const string formula = "a*x^2 + b - x/3 + (x - 1) * (x + 1)";
+    calc.SetOptimization(OPT_DEFAULT);
+    res = calc.Compile(formula, prog);
+    CThreadedProgram threaded;
+    threaded.Compile(prog);
+    double vars[3] = { 1.5, 2.5, 3.5 };
+    Bench("micro/PostfixEvaluate/interp", 1, [&]() {
+        vars[1] += 1;
+        sink = prog.Evaluate(vars);
+    }, res);
+    Bench("micro/PostfixEvaluate/threaded", 1, [&]() {
+        vars[1] += 1;
+        sink = threaded.Evaluate(vars);
+    }, res);
+    const size_t rows = 64 * 1024;
+    vector<vector<double>> columns(prog.Variables().size(), vector<double>(rows));
+    vector<const double*> cols;
+    for (auto& c : columns) {
+        for (size_t i = 0; i < rows; i++) {
+            c[i] = (double)(m_gen.Next() % 1000) / 7;
+        }
+        cols.push_back(c.data());
+    }
+    vector<double> out(rows);
+    Bench(string("micro/EvaluateColumns/") + CColumnKernels::Get().name, rows, [&]() {
+        prog.EvaluateColumns(cols.data(), rows, out.data());
+    }, res);
+
+    //whole single expression path
+    double result;
+    res = calc.Evaluate(expr, result);
+    Bench("micro/Evaluate", 1, [&]() {
+        calc.Evaluate(expr, result);
+        sink = result;
+    }, res);
+}
+
+void CCalcBench::Macro()
+{
+    CCalculator calc;
+    string out;
+
+    const unsigned int lines = 100000;
+    string text = m_gen.Lines(lines);
+    int res = CheckLines(calc, text);
+    Bench("macro/short_formulas", lines, [&]() {
+        out.clear();
+        calc.EvaluateLines(text, out);
+    }, res);
+    calc.SetOutput(OUTPUT_FORMAT::Binary);
+    Bench("macro/short_formulas/binary", lines, [&]() {
+        out.clear();
+        calc.EvaluateLines(text, out);
+    }, res);
+    calc.SetOutput(OUTPUT_FORMAT::Text);
+#ifdef CALC_PROFILE
+    //the same with the --stats stage timers running
+    CStageProfiler::Enable(true);
+    Bench("macro/short_formulas/stats", lines, [&]() {
+        out.clear();
+        calc.EvaluateLines(text, out);
+    }, res);
+    CStageProfiler::Enable(false);
+#endif
+
+    string nested = m_gen.Nested(1000);
+    double result;
+    res = calc.Evaluate(nested, result);
+    Bench("macro/nested_parens_1000", 1, [&]() {
+        calc.Evaluate(nested, result);
+        sink = result;
+    }, res);
+
+    //x + (x + (... + x)): every operand is pushed before the first addition,
+    //so the stack is deeper than COMPILED_STACK_SIZE and lives in the scratch arena
+    string deep;
+    for (unsigned int i = 0; i < 200; i++) {
+        deep += "x + (";
+    }
+    deep += "x" + string(200, ')');
+    CCompiledExpression prog;
+    res = calc.Compile(deep, prog);
+    const double x = 1.5;
+    Bench("macro/deep_stack_200", 1, [&]() {
+        sink = prog.Evaluate(&x);
+    }, res);
+    vector<double> column(COLUMN_BLOCK_SIZE, x);
+    vector<double> results(COLUMN_BLOCK_SIZE);
+    const double* cols[1] = { column.data() };
+    Bench("macro/deep_stack_200/columns", COLUMN_BLOCK_SIZE, [&]() {
+        prog.EvaluateColumns(cols, COLUMN_BLOCK_SIZE, results.data());
+    }, res);
+
+    string big = m_gen.Long(1000000);
+    res = calc.Evaluate(big, result);
+    Bench("macro/million_tokens", 1, [&]() {
+        calc.Evaluate(big, result);
+        sink = result;
+    }, res);
+}
+
+void CCalcBench::Session()
+{
+    //groups of an input and a chain of cells reading it, plus a total over every group:
+    //an update re-evaluates its chain and the total, whatever the size of the sheet
+    for (unsigned int groups : { 100, 1000 }) {
+        CCalcSession session;
+        string total = "0";
+        int res = CALC_OK;
+        for (unsigned int g = 0; g < groups && res == CALC_OK; g++) {
+            string in = "in" + to_string(g);
+            res = session.Define(in, "1");
+            string prev = in;
+            for (unsigned int i = 0; i < 10 && res == CALC_OK; i++) {
+                string cell = "c" + to_string(g) + "_" + to_string(i);
+                res = session.Define(cell, prev + " * 1.5 + " + in);
+                prev = cell;
+            }
+            if (g < 100) {
+                total += " + " + prev;
+            }
+        }
+        if (res == CALC_OK) {
+            res = session.Define("total", total);
+        }
+        vector<uint32_t> changed;
+        unsigned int n = 0;
+        Bench("session/update_input/" + to_string(groups * 11 + 1) + "_cells", 1, [&]() {
+            session.Define("in0", to_string(n++ % 100), &changed);
+            sink = (double)changed.size();
+        }, res);
+    }
+}
+
+void CCalcBench::Kernels()
+{
+    //every function at every supported level, over one column block
+    vector<double> src(COLUMN_BLOCK_SIZE);
+    vector<double> a(COLUMN_BLOCK_SIZE);
+    for (auto& v : src) {
+        v = (double)(m_gen.Next() % 20000) / 100 - 100;
+    }
+    const SIMD_LEVEL levels[] = { SIMD_LEVEL::Scalar, SIMD_LEVEL::SSE2, SIMD_LEVEL::AVX2 };
+    for (SIMD_LEVEL level : levels) {
+        const CColumnKernels& k = CColumnKernels::Get(level);
+        if (k.level != level) {
+            //not supported by this CPU
+            continue;
+        }
+        const pair<const char*, CColumnKernels::UnaryKernel> unary[] = {
+            { "sqrt", k.Sqrt }, { "abs", k.Abs }, { "exp", k.Exp }, { "log", k.Log }, { "sin", k.Sin }, { "cos", k.Cos },
+            { "exp_fast", k.FastExp }, { "log_fast", k.FastLog }, { "sin_fast", k.FastSin }, { "cos_fast", k.FastCos }
+        };
+        for (auto& f : unary) {
+            Bench(string("kernels/") + f.first + "/" + k.name, COLUMN_BLOCK_SIZE, [&]() {
+                memcpy(a.data(), src.data(), COLUMN_BLOCK_SIZE * sizeof(double));
+                f.second(a.data(), COLUMN_BLOCK_SIZE);
+                sink = a[0];
+            });
+        }
+        Bench(string("kernels/max/") + k.name, COLUMN_BLOCK_SIZE, [&]() {
+            memcpy(a.data(), src.data(), COLUMN_BLOCK_SIZE * sizeof(double));
+            k.Max(a.data(), src.data() + 1, COLUMN_BLOCK_SIZE - 1);
+            sink = a[0];
+        });
+    }
+}
+
+void CCalcBench::Logger()
+{
+    CNullWriter* writer = new CNullWriter;
+    CLogger::GetInstance().AddWriter(writer);
+    CLogger::GetInstance().SetLevelMask(LOG_ALL_LEVELS);
+    CLogger::GetInstance().SetFormatMask(LOG_FUNC_MAME | LOG_LINE_NUM | LOG_LOG_NUM);
+    CLogger::GetInstance().SetFormatter(LOG_FORMATTER::TEXT);
+    Bench("logger/Log/text", 1, [&]() {
+        CLogger::GetInstance().Log(LOG_DEBUG, __FILE__, __FUNCTION__, __LINE__, "push: %f\n", 3.5);
+    });
+    CLogger::GetInstance().SetFormatter(LOG_FORMATTER::COLORTEXT);
+    Bench("logger/Log/colortext", 1, [&]() {
+        CLogger::GetInstance().Log(LOG_DEBUG, __FILE__, __FUNCTION__, __LINE__, "push: %f\n", 3.5);
+    });
+    CLogger::GetInstance().SetFormatMask(LOG_ALL_COLUMNS);
+    CLogger::GetInstance().SetFormatter(LOG_FORMATTER::TEXT);
+    Bench("logger/Log/all_columns", 1, [&]() {
+        CLogger::GetInstance().Log(LOG_DEBUG, __FILE__, __FUNCTION__, __LINE__, "push: %f\n", 3.5);
+    });
+    //producer side cost, the writer thread formats in the background
+    CLogger::GetInstance().SetAsync(true, LOG_OVERFLOW::BLOCK);
+    Bench("logger/Log/async_block", 1, [&]() {
+        CLogger::GetInstance().Log(LOG_DEBUG, __FILE__, __FUNCTION__, __LINE__, "push: %f\n", 3.5);
+    });
+    CLogger::GetInstance().SetAsync(true, LOG_OVERFLOW::DROP);
+    Bench("logger/Log/async_drop", 1, [&]() {
+        CLogger::GetInstance().Log(LOG_DEBUG, __FILE__, __FUNCTION__, __LINE__, "push: %f\n", 3.5);
+    });
+    CLogger::GetInstance().SetAsync(false);
+    //call site path, formatted now or packed for calc_logdecode
+    CLogger::GetInstance().SetFormatter(LOG_FORMATTER::TEXT);
+    Bench("logger/LOGD/text", 1, [&]() {
+        LOGD("push: %f %.*s\n", 3.5, 3, "abc");
+    });
+    CLogger::GetInstance().SetFormatter(LOG_FORMATTER::BINARY);
+    Bench("logger/LOGD/binary", 1, [&]() {
+        LOGD("push: %f %.*s\n", 3.5, 3, "abc");
+    });
+    //level enabled, call site switched off at runtime
+    CLogger::GetInstance().SetSiteFilter("calc_bench.cpp", false);
+    Bench("logger/LOGD/site_off", 1, [&]() {
+        LOGD("push: %f\n", 3.5);
+    });
+    CLogger::GetInstance().ResetSiteFilters();
+    //record header alone: time, pid and tid capture, then the TEXT prefix with every column
+    CLogger& logger = CLogger::GetInstance();
+    SLogRecord rec;
+    Bench("logger/prefix/capture", 1, [&]() {
+        logger.Capture(rec, LOG_DEBUG, __FILE__, __FUNCTION__, __LINE__);
+    });
+    CLogger::GetInstance().SetFormatMask(LOG_ALL_COLUMNS);
+    char prefix[LOG_STR_LEN];
+    Bench("logger/prefix/all_columns", 1, [&]() {
+        logger.Capture(rec, LOG_DEBUG, __FILE__, __FUNCTION__, __LINE__);
+        sink = logger.TextFormatter(prefix, rec);
+    });
+    CLogger::GetInstance().SetLevelMask(LOG_ERROR | LOG_FATAL);
+    Bench("logger/LOGD/disabled", 1, [&]() {
+        LOGD("push: %f\n", 3.5);
+    });
+    sink = (double)writer->m_bytes;
+
+    //buffered, rotating file sink alone, 64 byte records
+    SLogFileOptions options;
+    options.max_size = 64 << 20;
+    options.max_files = 1;
+    string name = "calc_bench.log";
+    {
+        CFileWriter file(name, false, options);
+        const char record[] = "12 (DEBUG: CCalculator.cpp InfixToPostfix:190 push: 3.500000 3\n";
+        Bench("logger/CFileWriter/write", 1, [&]() {
+            file.Write(record, sizeof(record) - 1, LOG_DEBUG);
+        });
+    }
+    remove(name.c_str());
+    remove((name + ".1").c_str());
+}
+
+void CCalcBench::RunAll()
+{
+    Micro();
+    Macro();
+    Session();
+    Kernels();
+    Logger();
+}
+
+void CCalcBench::WriteJson(FILE* f)
+{
+    fprintf(f, "{\n  \"context\": {\n");
+#if defined(__clang__)
+    fprintf(f, "    \"compiler\": \"clang %s\",\n", __clang_version__);
+#elif defined(__GNUC__)
+    fprintf(f, "    \"compiler\": \"gcc %s\",\n", __VERSION__);
+#elif defined(_MSC_VER)
+    fprintf(f, "    \"compiler\": \"msvc %d\",\n", _MSC_VER);
+#endif
+    fprintf(f, "    \"simd\": \"%s\",\n", CColumnKernels::Get().name);
+    fprintf(f, "    \"alloc_counter\": %s,\n", CAllocCounter::Enabled() ? "true" : "false");
+    fprintf(f, "    \"min_time_s\": %g\n  },\n", m_min_time);
+    fprintf(f, "  \"benchmarks\": [\n");
+    for (size_t i = 0; i < m_results.size(); i++) {
+        const SBenchResult& r = m_results[i];
+        if (r.error.size()) {
+            fprintf(f, "    {\"name\": \"%s\", \"error\": \"%s\"}%s\n",
+                r.name.c_str(), r.error.c_str(), i + 1 < m_results.size() ? "," : "");
+            continue;
+        }
+        fprintf(f, "    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.3f, \"ops_per_sec\": %.1f",
+            r.name.c_str(), (unsigned long long)r.iterations, r.ns_per_op, 1e9 / r.ns_per_op);
+        if (CAllocCounter::Enabled()) {
+            fprintf(f, ", \"allocs_per_op\": %.4f", r.allocs_per_op);
+        }
+        fprintf(f, "}%s\n", i + 1 < m_results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+int main(int argc, char* argv[])
+{
+    string filter;
+    string out;
+    double min_time = 0.5;
+    for (int i = 1; i < argc; i++) {
+        string arg(argv[i]);
+        if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        }
+        else if (arg == "--min-time" && i + 1 < argc) {
+            min_time = atof(argv[++i]);
+        }
+        else if (arg == "--out" && i + 1 < argc) {
+            out = argv[++i];
+        }
+        else {
+            cerr << "Usage: " << argv[0] << " [--filter <substring>] [--min-time <seconds>] [--out <file>]" << endl;
+            return -1;
+        }
+    }
+
+    CCalcBench bench(filter, min_time);
+    bench.RunAll();
+
+    FILE* f = out.empty() ? stdout : fopen(out.c_str(), "w");
+    if (!f) {
+        cerr << "Can't open output file: " << out << endl;
+        return -1;
+    }
+    bench.WriteJson(f);
+    if (f != stdout) {
+        fclose(f);
+    }
+    //the JSON is written anyway, the failing cases carry an "error" field
+    return bench.Errors() ? -1 : 0;
+}
@@ -0,0 +1,213 @@
+// calc_loadgen.cpp : load generator of the Calc --serve server. Keeps <depth> requests
+// in flight on each of <connections> connections and reports throughput and the
+// request latency percentiles. The server must use text output.
+//
+// calc_loadgen (--socket <path>|--port <n>) [-c <connections>] [-d <depth>] [-n <requests>]
+//
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "CHistogram.h"
+
+using namespace std;
+
+typedef chrono::steady_clock loadclock;
+
+struct SConnection {
+    int fd;
+    string out;                     //requests not yet written
+    size_t sent = 0;
+    string in;                      //partial response line
+    deque<loadclock::time_point> inflight;
+};
+
+//deterministic expressions, the same load on every run
+class CRequests
+{
+public:
+    string Next()
+    {
+        static const char ops[] = "+-*/";
+        string e = to_string(Rand() % 99 + 1);
+        unsigned int n = Rand() % 11 + 2;
+        for (unsigned int i = 0; i < n; i++) {
+            e += ' ';
+            e += ops[Rand() % 4];
+            e += ' ';
+            e += to_string(Rand() % 999 + 1);
+        }
+        e += '\n';
+        return e;
+    }
+private:
+    uint64_t m_state = 1;
+
+    uint32_t Rand()
+    {
+        m_state = m_state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (uint32_t)(m_state >> 33);
+    }
+};
+
+static int Connect(const string& socket_path, unsigned int port)
+{
+    int fd;
+    int res;
+    if (socket_path.size()) {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        res = fd < 0 ? -1 : connect(fd, (sockaddr*)&addr, sizeof(addr));
+    }
+    else {
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        res = fd < 0 ? -1 : connect(fd, (sockaddr*)&addr, sizeof(addr));
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    if (res < 0) {
+        cerr << "can't connect: " << strerror(errno) << endl;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+int main(int argc, char* argv[])
+{
+    string socket_path;
+    unsigned int port = 0;
+    unsigned int connections = 8;
+    unsigned int depth = 16;
+    uint64_t requests = 1000000;
+    for (int i = 1; i < argc; i++) {
+        string arg(argv[i]);
+        if (arg == "--socket" && i + 1 < argc) {
+            socket_path = argv[++i];
+        }
+        else if (arg == "--port" && i + 1 < argc) {
+            port = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "-c" && i + 1 < argc) {
+            connections = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "-d" && i + 1 < argc) {
+            depth = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "-n" && i + 1 < argc) {
+            requests = strtoull(argv[++i], nullptr, 10);
+        }
+        else {
+            socket_path.clear();
+            port = 0;
+            break;
+        }
+    }
+    if ((socket_path.empty() && !port) || !connections || !depth) {
+        cerr << "Usage: " << argv[0] << " (--socket <path>|--port <n>) [-c <connections>] [-d <depth>] [-n <requests>]" << endl;
+        return -1;
+    }
+
+    vector<SConnection> conns(connections);
+    for (auto& c : conns) {
+        if ((c.fd = Connect(socket_path, port)) < 0) {
+            return -1;
+        }
+    }
+
+    CRequests gen;
+    CHistogram latency;
+    uint64_t issued = 0, done = 0, errors = 0;
+    vector<pollfd> fds(connections);
+    char buff[64 * 1024];
+    auto start = loadclock::now();
+    while (done < requests) {
+        for (unsigned int i = 0; i < connections; i++) {
+            SConnection& c = conns[i];
+            //top the pipeline up, the requests of one round go out in one write
+            auto now = loadclock::now();
+            while (c.inflight.size() < depth && issued < requests) {
+                c.out += gen.Next();
+                c.inflight.push_back(now);
+                issued++;
+            }
+            fds[i].fd = c.fd;
+            fds[i].events = POLLIN | (c.sent < c.out.size() ? POLLOUT : 0);
+            fds[i].revents = 0;
+        }
+        if (poll(fds.data(), fds.size(), 10000) <= 0) {
+            cerr << "the server does not answer" << endl;
+            return -1;
+        }
+        for (unsigned int i = 0; i < connections; i++) {
+            SConnection& c = conns[i];
+            if (fds[i].revents & POLLOUT) {
+                ssize_t n = send(c.fd, c.out.data() + c.sent, c.out.size() - c.sent, MSG_NOSIGNAL);
+                if (n > 0) {
+                    c.sent += n;
+                }
+                if (c.sent == c.out.size()) {
+                    c.out.clear();
+                    c.sent = 0;
+                }
+            }
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                ssize_t n = read(c.fd, buff, sizeof(buff));
+                if (n <= 0) {
+                    if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+                        continue;
+                    }
+                    cerr << "the server closed the connection" << endl;
+                    return -1;
+                }
+                auto now = loadclock::now();
+                c.in.append(buff, n);
+                size_t pos = 0, end;
+                while ((end = c.in.find('\n', pos)) != string::npos) {
+                    if (c.in.compare(pos, 6, "error:") == 0) {
+                        errors++;
+                    }
+                    if (c.inflight.size()) {
+                        latency.Record((uint64_t)chrono::duration_cast<chrono::nanoseconds>(now - c.inflight.front()).count());
+                        c.inflight.pop_front();
+                    }
+                    done++;
+                    pos = end + 1;
+                }
+                c.in.erase(0, pos);
+            }
+        }
+    }
+    double seconds = chrono::duration<double>(loadclock::now() - start).count();
+    for (auto& c : conns) {
+        close(c.fd);
+    }
+
+    cout << "requests " << done << " in " << seconds << " s, " << (uint64_t)(done / seconds) << " req/s, "
+        << errors << " errors" << endl;
+    cout << "latency us p50 " << latency.Percentile(0.5) / 1000.0 << " p99 " << latency.Percentile(0.99) / 1000.0
+        << " p99.9 " << latency.Percentile(0.999) / 1000.0 << " max " << latency.Max() / 1000.0 << endl;
+    return 0;
+}
@@ -0,0 +1,216 @@
+// calc_logdecode.cpp : turns a binary log written with LOG_FORMATTER::BINARY back into
+// the TEXT, COLORTEXT or EXCEL layout.
+//
+// calc_logdecode [-f text|color|excel] [-c <column mask>|all] <file|->
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "CLogger.h"
+
+using namespace std;
+
+//call site read from the log, owns the strings SLogSite points to
+struct SDecodedSite {
+    string file;
+    string function;
+    string format;
+    SLogSite site;
+};
+
+class CLogDecoder
+{
+public:
+    CLogDecoder(const string& data) : m_data(data), m_pos(0) {}
+    //replays every record through CLogger, returns the number of records or -1 on a damaged log
+    int Run();
+private:
+    const string& m_data;
+    size_t m_pos;
+    map<uint32_t, unique_ptr<SDecodedSite>> m_sites;
+
+    template<typename T>
+    bool Get(T& v)
+    {
+        if (m_data.size() - m_pos < sizeof(T)) {
+            return false;
+        }
+        memcpy(&v, m_data.data() + m_pos, sizeof(T));
+        m_pos += sizeof(T);
+        return true;
+    }
+    bool GetString(string& s);
+    bool GetString(const char*& s, int& len);
+};
+
+bool CLogDecoder::GetString(const char*& s, int& len)
+{
+    uint16_t n;
+    if (!Get(n) || m_data.size() - m_pos < n) {
+        return false;
+    }
+    s = m_data.data() + m_pos;
+    len = n;
+    m_pos += n;
+    return true;
+}
+
+bool CLogDecoder::GetString(string& s)
+{
+    const char* p;
+    int len;
+    if (!GetString(p, len)) {
+        return false;
+    }
+    s.assign(p, len);
+    return true;
+}
+
+int CLogDecoder::Run()
+{
+    int records = 0;
+    SLogRecord rec;
+    while (m_pos < m_data.size()) {
+        char type = m_data[m_pos++];
+        if (type == LOG_BIN_HEADER) {
+            //repeated whenever a writer or the formatter was changed
+            if (m_pos + sizeof(LOG_BIN_MAGIC) > m_data.size() ||
+                m_data.compare(m_pos, sizeof(LOG_BIN_MAGIC) - 1, LOG_BIN_MAGIC) ||
+                m_data[m_pos + sizeof(LOG_BIN_MAGIC) - 1] != LOG_BIN_VERSION) {
+                cerr << "not a binary log or unsupported version" << endl;
+                return -1;
+            }
+            m_pos += sizeof(LOG_BIN_MAGIC);
+        }
+        else if (type == LOG_BIN_SITE) {
+            unique_ptr<SDecodedSite> s(new SDecodedSite());
+            uint32_t id;
+            int32_t level, line;
+            if (!Get(id) || !Get(level) || !Get(line) ||
+                !GetString(s->file) || !GetString(s->function) || !GetString(s->format)) {
+                break;
+            }
+            s->site.level = level;
+            s->site.line = line;
+            s->site.file = s->file.c_str();
+            s->site.function = s->function.c_str();
+            s->site.format = s->format.c_str();
+            s->site.id = id;
+            m_sites[id] = move(s);
+        }
+        else if (type == LOG_BIN_RECORD) {
+            uint32_t id;
+            uint16_t len;
+            if (!Get(id) || !Get(rec.time_us) || !Get(rec.pid) || !Get(rec.tid) || !Get(len) ||
+                m_data.size() - m_pos < len) {
+                break;
+            }
+            auto it = m_sites.find(id);
+            if (it == m_sites.end()) {
+                cerr << "record of an undefined call site " << id << endl;
+                return -1;
+            }
+            const SLogSite& site = it->second->site;
+            rec.site = nullptr;
+            rec.level = site.level;
+            rec.file = site.file;
+            rec.function = site.function;
+            rec.line = site.line;
+            rec.len = CLogger::FormatPacked(rec.msg, site.format, m_data.data() + m_pos, len);
+            m_pos += len;
+            CLogger::GetInstance().Replay(rec);
+            records++;
+        }
+        else if (type == LOG_BIN_MESSAGE) {
+            int32_t level, line;
+            const char* file;
+            const char* function;
+            const char* msg;
+            int file_len, function_len;
+            if (!Get(level) || !Get(line) || !Get(rec.time_us) || !Get(rec.pid) || !Get(rec.tid) ||
+                !GetString(file, file_len) || !GetString(function, function_len) || !GetString(msg, rec.len)) {
+                break;
+            }
+            string file_name(file, file_len), function_name(function, function_len);
+            rec.site = nullptr;
+            rec.level = level;
+            rec.line = line;
+            rec.file = file_name.c_str();
+            rec.function = function_name.c_str();
+            if (rec.len >= LOG_STR_LEN) {
+                rec.len = LOG_STR_LEN - 1;
+            }
+            memcpy(rec.msg, msg, rec.len);
+            rec.msg[rec.len] = 0;
+            CLogger::GetInstance().Replay(rec);
+            records++;
+        }
+        else {
+            cerr << "unknown record type at offset " << m_pos - 1 << endl;
+            return -1;
+        }
+    }
+    if (m_pos < m_data.size()) {
+        //the last record was cut, the process did not finish writing it
+        cerr << "truncated record at the end of the log" << endl;
+    }
+    return records;
+}
+
+int main(int argc, char* argv[])
+{
+    LOG_FORMATTER formatter = LOG_FORMATTER::TEXT;
+    uint32_t columns = LOG_FILE_NAME | LOG_FUNC_MAME | LOG_LINE_NUM;
+    string name;
+    for (int i = 1; i < argc; i++) {
+        string arg(argv[i]);
+        if (arg == "-f" && i + 1 < argc) {
+            string f(argv[++i]);
+            formatter = f == "color" ? LOG_FORMATTER::COLORTEXT
+                : f == "excel" ? LOG_FORMATTER::EXCEL : LOG_FORMATTER::TEXT;
+        }
+        else if (arg == "-c" && i + 1 < argc) {
+            string c(argv[++i]);
+            columns = c == "all" ? LOG_ALL_COLUMNS : (uint32_t)strtoul(c.c_str(), nullptr, 0);
+        }
+        else if (name.empty() && arg.size() && (arg[0] != '-' || arg == "-")) {
+            name = arg;
+        }
+        else {
+            name.clear();
+            break;
+        }
+    }
+    if (name.empty()) {
+        cerr << "Usage: " << argv[0] << " [-f text|color|excel] [-c <column mask>|all] <file|->" << endl;
+        return -1;
+    }
+
+    string data;
+    if (name == "-") {
+        data.assign(istreambuf_iterator<char>(cin), istreambuf_iterator<char>());
+    }
+    else {
+        ifstream f(name, ios::in | ios::binary);
+        if (!f) {
+            cerr << "can't open " << name << endl;
+            return -1;
+        }
+        data.assign(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+    }
+
+    CLogger::GetInstance().AddWriter(new CConsoleWriter);
+    CLogger::GetInstance().SetFormatMask(columns);
+    CLogger::GetInstance().SetFormatter(formatter);
+    CLogDecoder decoder(data);
+    int res = decoder.Run();
+    fflush(stdout);
+    return res < 0 ? -1 : 0;
+}